@@ -0,0 +1,143 @@
+/* bench_e2e
+*
+* End-to-end benchmark: runs the scenarios of examples.sh headless (rendering to
+* a png) on the synthetic files of gen_data, at each of the given sizes, and
+* reports each run's wall time, its throughput in points (rows x data layers)
+* per second, and its peak RSS: that of the gg process or of gnuplot, whichever
+* is larger (wait4() reports the maximum over a process and the children it
+* has waited for, and gg waits for gnuplot).
+* The files are generated in data_dir if they aren't there yet, and reused.
+* The timings include gnuplot's render, so gnuplot must be on the PATH.
+*
+* usage: bench_e2e [main] [data_dir] [n_rows ...]
+*/
+
+#define GEN_DATA_NO_MAIN
+#define GG_PLOT_NO_MAIN
+#include "../main.cpp"
+#include "gen_data.cpp"
+
+#include <sys/resource.h>
+
+
+struct Scenario {
+    const char* name;
+    std::vector<std::string> args; // {dat}, {csv} and {dir} are replaced
+    size_t n_layers;               // layers that draw every row
+    bool warm_up = false;          // run once first (e.g., to fill a cache)
+};
+
+const std::vector<Scenario> scenarios = {
+    {"points+line", {"-G", "{dat}", "-x1", "-P", "", "-y3", "--shape", "7", "--size", "0.5",
+                     "-L", "", "-y2"}, 2},
+    {"points+line --load", {"-G", "{dat}", "-x1", "--load", "-P", "", "-y3", "--shape", "7",
+                            "-L", "", "-y2"}, 2},
+    {"points+line --cache", {"-G", "{dat}", "-x1", "--cache", "{dir}/cache", "-P", "", "-y3",
+                             "--shape", "7", "-L", "", "-y2"}, 2, true},
+    {"zoomed --cache --xlim", {"-G", "{dat}", "-x1", "--cache", "{dir}/cache", "--xlim", "4:4.5",
+                               "-L", "", "-y3"}, 1, true},
+    {"expressions --load", {"-G", "{dat}", "--load", "-P", "", "-x", "x", "-y", "($2 - $3)"}, 1},
+    {"downsample minmax", {"-G", "{dat}", "-x1", "-L", "", "-y3", "--downsample", "2000",
+                           "--downsample_method", "minmax"}, 1},
+    {"smooth", {"-G", "{dat}", "-x1", "-P", "", "-y3", "-S", "", "-y3"}, 2},
+    {"histogram", {"-G", "{dat}", "-H", "", "-x3", "--bins", "20"}, 1},
+    {"bin2d", {"-G", "{dat}", "-D", "", "-x1", "-y3", "--bins", "40,20"}, 1},
+    {"csv points", {"-G", "{csv}", "--sep", ",", "-P", "", "-x", "x", "-y", "y", "--shape", "7"}, 1},
+    {"csv facet", {"-G", "{csv}", "--sep", ",", "-x", "x", "-L", "", "-y", "y",
+                   "--facet", "-x", "g"}, 1},
+};
+
+std::string replace_all(std::string s, const std::string& from, const std::string& to) {
+    for (size_t pos = 0; (pos = s.find(from, pos)) != std::string::npos; pos += to.size()) {
+        s.replace(pos, from.size(), to);
+    }
+    return s;
+}
+
+struct RunResult {
+    bool ok;
+    double secs;
+    long max_rss_kb; // of gg or gnuplot, whichever is larger
+};
+
+// run main with args (output to /dev/null), timing it until it exits
+RunResult run(const std::string& main_path, const std::vector<std::string>& args) {
+    std::vector<char*> argv = {const_cast<char*>(main_path.c_str())};
+    for (const std::string& arg : args) {
+        argv.push_back(const_cast<char*>(arg.c_str()));
+    }
+    argv.push_back(nullptr);
+    auto start = std::chrono::steady_clock::now();
+    pid_t pid = fork();
+    if (pid < 0) {
+        return {false, 0, 0};
+    }
+    if (pid == 0) {
+        int null_fd = ::open("/dev/null", O_RDWR);
+        dup2(null_fd, STDIN_FILENO);
+        dup2(null_fd, STDOUT_FILENO);
+        dup2(null_fd, STDERR_FILENO);
+        execv(main_path.c_str(), argv.data());
+        _exit(127);
+    }
+    int status = 0;
+    struct rusage usage;
+    wait4(pid, &status, 0, &usage);
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return {WIFEXITED(status) && WEXITSTATUS(status) == 0, secs, usage.ru_maxrss};
+}
+
+bool file_exists(const std::string& path) {
+    struct stat st;
+    return stat(path.c_str(), &st) == 0;
+}
+
+
+int main(int argc, char* argv[]) {
+    std::string main_path = (argc > 1) ? argv[1] : "./bench/main";
+    std::string dir = (argc > 2) ? argv[2] : "/tmp/gg_bench";
+    std::vector<size_t> sizes;
+    for (int i = 3; i < argc; i++) {
+        sizes.push_back(std::stoul(argv[i]));
+    }
+    if (sizes.empty()) {
+        sizes = {10000, 100000, 1000000};
+    }
+    if (!file_exists(main_path)) {
+        std::cerr << "Error: no '" << main_path << "' to benchmark\n";
+        return EXIT_FAILURE;
+    }
+    mkdir(dir.c_str(), 0755); // (may exist already)
+
+    printf("%-24s %10s %10s %12s %10s\n", "scenario", "rows", "ms", "Mpoints/s", "max RSS MB");
+    int ret = EXIT_SUCCESS;
+    for (size_t n_rows : sizes) {
+        std::string dat = dir + "/bench_" + std::to_string(n_rows) + ".dat";
+        std::string csv = dir + "/bench_" + std::to_string(n_rows) + ".csv";
+        if ((!file_exists(dat) && !generate("dat", n_rows, dat))
+            || (!file_exists(csv) && !generate("csv", n_rows, csv))) {
+            return EXIT_FAILURE;
+        }
+        for (const Scenario& sc : scenarios) {
+            std::vector<std::string> args;
+            for (const std::string& arg : sc.args) {
+                args.push_back(replace_all(replace_all(replace_all(arg, "{dat}", dat), "{csv}", csv),
+                                           "{dir}", dir));
+            }
+            args.push_back("--output");
+            args.push_back(dir + "/out.png");
+            args.push_back("--quiet");
+            if (sc.warm_up) {
+                run(main_path, args);
+            }
+            RunResult r = run(main_path, args);
+            printf("%-24s %10zu %10.1f %12.2f %10.1f%s\n", sc.name, n_rows, r.secs * 1e3,
+                   n_rows * sc.n_layers / r.secs / 1e6, r.max_rss_kb / 1024.0, r.ok ? "" : "  (failed)");
+            fflush(stdout);
+            if (!r.ok) {
+                ret = EXIT_FAILURE;
+            }
+        }
+    }
+    return ret;
+}
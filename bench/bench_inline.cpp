@@ -0,0 +1,131 @@
+/* bench_inline
+*
+* Micro-benchmark for the inline data path (-x "1,2,3" -y "4,5,6"): splits the
+* comma-joined columns and builds the data block sent to gnuplot.
+* The rows of a data file (data/cubic.dat by default) are repeated until there
+* are n_rows points, and the current implementation is timed against the
+* original substr/concatenation one.
+*
+* usage: bench_inline [file] [n_rows]
+*/
+
+#define GG_PLOT_NO_MAIN
+#include "../main.cpp"
+
+#include <chrono>
+#include <sstream>
+
+
+// the original implementation, kept as the reference point
+namespace reference {
+    std::vector<std::string> parse_data(const std::string& data_str) {
+        std::vector<std::string> data;
+        size_t pos = 0;
+        while (pos < data_str.size()) {
+            size_t next_pos = data_str.find(',', pos);
+            if (next_pos == std::string::npos) {
+                next_pos = data_str.size();
+            }
+            data.push_back( data_str.substr(pos, next_pos - pos) );
+            pos = next_pos + 1;
+        }
+        return data;
+    }
+
+    std::string get_inline_data(const std::vector<std::string>& x,
+                                const std::vector<std::string>& y) {
+        std::string result = "";
+        size_t y_size = y.size();
+        for (size_t i = 0; i < x.size(); i++) {
+            if (i >= y_size) {
+                break;
+            }
+            result += x[i] + " " + y[i] + "\n";
+        }
+        result += "e\n";
+        return result;
+    }
+}
+
+
+// read the first two columns of a space-delimited file, skipping the header
+bool read_columns(const std::string& path, std::vector<std::string>& xs,
+                  std::vector<std::string>& ys) {
+    std::ifstream in(path);
+    if (!in) {
+        return false;
+    }
+    std::string line, x, y;
+    std::getline(in, line); // header
+    while (std::getline(in, line)) {
+        std::istringstream fields(line);
+        if (fields >> x >> y) {
+            xs.push_back(x);
+            ys.push_back(y);
+        }
+    }
+    return !xs.empty();
+}
+
+std::string join_repeated(const std::vector<std::string>& values, size_t n_rows) {
+    std::string joined;
+    for (size_t i = 0; i < n_rows; i++) {
+        if (i > 0) {
+            joined += ',';
+        }
+        joined += values[i % values.size()];
+    }
+    return joined;
+}
+
+double seconds_since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+void report(const char* name, double secs, size_t n_rows, size_t out_bytes) {
+    printf("%-12s %8.3f s  %8.2f Mpoints/s  %10zu bytes\n",
+           name, secs, n_rows / secs / 1e6, out_bytes);
+}
+
+
+int main(int argc, char* argv[]) {
+    std::string path = (argc > 1) ? argv[1] : "data/cubic.dat";
+    size_t n_rows = (argc > 2) ? std::stoul(argv[2]) : 10000000;
+
+    std::vector<std::string> xs, ys;
+    if (!read_columns(path, xs, ys)) {
+        std::cerr << "Error: could not read data from '" << path << "'\n";
+        return EXIT_FAILURE;
+    }
+    std::string x_data = join_repeated(xs, n_rows);
+    std::string y_data = join_repeated(ys, n_rows);
+    printf("%zu rows from %s (%zu + %zu bytes of input)\n",
+           n_rows, path.c_str(), x_data.size(), y_data.size());
+
+    auto start = std::chrono::steady_clock::now();
+    size_t out_bytes;
+    {
+        std::vector<std::string> x = reference::parse_data(x_data);
+        std::vector<std::string> y = reference::parse_data(y_data);
+        out_bytes = reference::get_inline_data(x, y).size();
+    }
+    report("reference", seconds_since(start), n_rows, out_bytes);
+
+    for (const char* binary : {"0", "1"}) {
+        start = std::chrono::steady_clock::now();
+        {
+            Environment global, local;
+            DataStore data;
+            local.insert(Key::file, "-");
+            local.insert(Key::x_data, x_data);
+            local.insert(Key::y_data, y_data);
+            local.insert(Key::binary, binary);
+            PointLayer layer(global, local, data);
+            layer.compose();
+            out_bytes = layer.get_inline_data().size();
+        }
+        report(binary[0] == '1' ? "binary" : "text", seconds_since(start), n_rows, out_bytes);
+    }
+
+    return 0;
+}
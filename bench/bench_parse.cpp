@@ -0,0 +1,203 @@
+/* bench_parse
+*
+* Micro-benchmark for the byte scanning and number formatting paths: splitting
+* comma-joined inline columns, parsing the rows of a data file, and writing
+* doubles back as text.
+* The rows of a data file (data/cubic.dat by default) are repeated until there
+* are n_rows rows. Each path is timed with the SIMD scan on and off, against
+* the original line-by-line implementation.
+*
+* usage: bench_parse [file] [n_rows]
+*/
+
+#define GG_PLOT_NO_MAIN
+#include "../main.cpp"
+
+#include <chrono>
+
+
+// the original implementations, kept as the reference point
+namespace reference {
+    std::vector<std::string> parse_data(const std::string& data_str) {
+        std::vector<std::string> data;
+        size_t pos = 0;
+        while (pos < data_str.size()) {
+            size_t next_pos = data_str.find(',', pos);
+            if (next_pos == std::string::npos) {
+                next_pos = data_str.size();
+            }
+            data.push_back( data_str.substr(pos, next_pos - pos) );
+            pos = next_pos + 1;
+        }
+        return data;
+    }
+
+    void split_fields(std::string_view line, char delim, std::vector<std::string_view>& fields) {
+        fields.clear();
+        size_t pos = 0, n = line.size();
+        bool quoted = false;
+        if (delim != ' ') {
+            size_t start = 0;
+            for (; pos < n; pos++) {
+                if (line[pos] == '"') {
+                    quoted = !quoted;
+                } else if (line[pos] == delim && !quoted) {
+                    fields.push_back(line.substr(start, pos - start));
+                    start = pos + 1;
+                }
+            }
+            fields.push_back(line.substr(start));
+            return;
+        }
+        while (pos < n) {
+            while (pos < n && (line[pos] == ' ' || line[pos] == '\t'))
+                pos++;
+            if (pos == n)
+                break;
+            size_t start = pos;
+            for (; pos < n; pos++) {
+                if (line[pos] == '"') {
+                    quoted = !quoted;
+                } else if ((line[pos] == ' ' || line[pos] == '\t') && !quoted) {
+                    break;
+                }
+            }
+            fields.push_back(line.substr(start, pos - start));
+        }
+    }
+
+    void parse_rows(std::string_view text, char delim, std::vector<std::vector<double>>& columns) {
+        std::vector<std::string_view> fields;
+        size_t pos = 0;
+        double value;
+        while (pos < text.size()) {
+            std::string_view line = next_line(text, pos);
+            if (skip_line(line))
+                continue;
+            split_fields(line, delim, fields);
+            for (size_t j = 0; j < columns.size(); j++) {
+                if (j >= fields.size() || !parse_double(fields[j], value)) {
+                    value = std::numeric_limits<double>::quiet_NaN();
+                }
+                columns[j].push_back(value);
+            }
+        }
+    }
+}
+
+
+double seconds_since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+void report(const char* name, double secs, size_t n_rows, size_t n_bytes) {
+    printf("  %-16s %8.3f s  %8.2f Mrows/s  %8.1f MB/s\n",
+           name, secs, n_rows / secs / 1e6, n_bytes / secs / 1e6);
+}
+
+// the rows of the file after its header, repeated to n_rows
+std::string repeat_rows(std::string_view text, size_t n_rows) {
+    size_t pos = 0;
+    next_line(text, pos); // header
+    std::vector<std::string_view> lines;
+    while (pos < text.size()) {
+        std::string_view line = next_line(text, pos);
+        if (!skip_line(line))
+            lines.push_back(line);
+    }
+    std::string rows;
+    for (size_t i = 0; i < n_rows && !lines.empty(); i++) {
+        rows += lines[i % lines.size()];
+        rows += '\n';
+    }
+    return rows;
+}
+
+
+int main(int argc, char* argv[]) {
+    std::string path = (argc > 1) ? argv[1] : "data/cubic.dat";
+    size_t n_rows = (argc > 2) ? std::stoul(argv[2]) : 10000000;
+
+    MappedFile file;
+    if (!file.open(path)) {
+        return EXIT_FAILURE;
+    }
+    std::string rows = repeat_rows(file.text(), n_rows);
+    if (rows.empty()) {
+        std::cerr << "Error: no rows in '" << path << "'\n";
+        return EXIT_FAILURE;
+    }
+    const size_t n_cols = 2;
+
+    // the first column, comma-joined as for -x
+    std::string joined;
+    {
+        std::vector<std::vector<double>> columns(1);
+        parse_rows(rows, ' ', columns);
+        char buf[32];
+        for (double v : columns[0]) {
+            joined.append(buf, format_double(v, buf));
+            joined += ',';
+        }
+        joined.pop_back();
+    }
+    printf("%zu rows from %s, simd %s\n", n_rows, path.c_str(),
+           simd_supported() ? "available" : "not available");
+
+    auto start = std::chrono::steady_clock::now();
+    size_t n_tokens = 0;
+
+    printf("parse_data (%zu bytes)\n", joined.size());
+    n_tokens = reference::parse_data(joined).size();
+    report("reference", seconds_since(start), n_tokens, joined.size());
+    for (bool simd : {false, true}) {
+        simd_scan = simd && simd_supported();
+        start = std::chrono::steady_clock::now();
+        n_tokens = parse_data(joined).size();
+        report(simd ? "simd" : "scalar", seconds_since(start), n_tokens, joined.size());
+    }
+
+    printf("parse_rows (%zu bytes)\n", rows.size());
+    {
+        std::vector<std::vector<double>> columns(n_cols);
+        start = std::chrono::steady_clock::now();
+        reference::parse_rows(rows, ' ', columns);
+        report("reference", seconds_since(start), columns[0].size(), rows.size());
+    }
+    for (bool simd : {false, true}) {
+        simd_scan = simd && simd_supported();
+        std::vector<std::vector<double>> columns(n_cols);
+        start = std::chrono::steady_clock::now();
+        parse_rows(rows, ' ', columns);
+        report(simd ? "simd" : "scalar", seconds_since(start), columns[0].size(), rows.size());
+    }
+    simd_scan = simd_supported();
+
+    std::vector<std::vector<double>> columns(n_cols);
+    parse_rows(rows, ' ', columns);
+    std::string out(columns[0].size() * 2 * 32, '\0');
+    size_t n_bytes;
+
+    printf("format (%zu values)\n", columns[0].size() * n_cols);
+    auto run_format = [&](const char* name, auto format) {
+        char* p = out.data();
+        start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < columns[0].size(); i++) {
+            for (size_t j = 0; j < n_cols; j++) {
+                p += format(columns[j][i], p);
+                *p++ = ' ';
+            }
+        }
+        n_bytes = p - out.data();
+        report(name, seconds_since(start), columns[0].size(), n_bytes);
+    };
+    run_format("snprintf %.17g", [](double v, char* buf) {
+        return static_cast<size_t>(snprintf(buf, 32, "%.17g", v));
+    });
+    run_format("to_chars", [](double v, char* buf) {
+        return static_cast<size_t>(std::to_chars(buf, buf + 32, v).ptr - buf);
+    });
+    run_format("format_double", format_double);
+
+    return 0;
+}
@@ -0,0 +1,98 @@
+/* gen_data
+*
+* Generator of large synthetic data files, in the formats of the files in data/:
+*   dat: space-delimited with a quoted header, like data/cubic.dat -
+*        "x" "y" "z", with y = x^3 and z = y plus noise that grows with x
+*   csv: comma-separated with a quoted header, like data/test.csv -
+*        "x","y","g", with y = 10 sin(x) plus noise, and a group g of a..d
+* x runs evenly from 1 to 10 (dat) or 0 to n_rows / 100 (csv). The noise comes
+* from a fixed seed, so a file of the same size is always the same.
+*
+* usage: gen_data dat|csv n_rows path
+*/
+
+#ifndef GEN_DATA_NO_MAIN
+#define GG_PLOT_NO_MAIN
+#include "../main.cpp"
+#endif
+
+
+// a standard normal deviate, from a fixed-seed LCG (Box-Muller)
+class Noise {
+    private:
+        uint64_t state = 0x9e3779b97f4a7c15ull;
+        bool has_spare = false;
+        double spare = 0;
+        double _uniform() {
+            state = state * 6364136223846793005ull + 1442695040888963407ull;
+            return ((state >> 11) + 0.5) * (1.0 / 9007199254740992.0);
+        }
+    public:
+        double next() {
+            if (has_spare) {
+                has_spare = false;
+                return spare;
+            }
+            double r = std::sqrt(-2 * std::log(_uniform())), t = 2 * M_PI * _uniform();
+            spare = r * std::sin(t);
+            has_spare = true;
+            return r * std::cos(t);
+        }
+};
+
+// write n_rows rows of the given format to path, false on an error
+bool generate(const std::string& format, size_t n_rows, const std::string& path) {
+    if (format != "dat" && format != "csv") {
+        std::cerr << "Error: unknown format '" << format << "', use dat or csv\n";
+        return false;
+    }
+    int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        std::cerr << "Error: could not open '" << path << "': " << std::strerror(errno) << "\n";
+        return false;
+    }
+    const bool csv = (format == "csv");
+    const char delim = csv ? ',' : ' ';
+    PipeWriter out(fd);
+    out.write(csv ? "\"x\",\"y\",\"g\"\n" : "\"x\" \"y\" \"z\"\n");
+    Noise noise;
+    for (size_t i = 0; i < n_rows; i++) {
+        char* start = out.claim(3 * 33);
+        char* pos = start;
+        if (csv) {
+            double x = i / 100.0;
+            pos += format_double(x, pos);
+            *pos++ = delim;
+            pos += format_double(10 * std::sin(x) + noise.next(), pos);
+            *pos++ = delim;
+            *pos++ = static_cast<char>('a' + i % 4);
+        } else {
+            double x = (n_rows > 1) ? 1 + 9.0 * i / (n_rows - 1) : 1;
+            double y = x * x * x;
+            pos += format_double(x, pos);
+            *pos++ = delim;
+            pos += format_double(y, pos);
+            *pos++ = delim;
+            pos += format_double(y + 10 * x * noise.next(), pos);
+        }
+        *pos++ = '\n';
+        out.commit(start, pos - start);
+    }
+    bool ok = out.finish();
+    ok = (close(fd) == 0) && ok;
+    if (!ok) {
+        std::cerr << "Error: writing '" << path << "': " << std::strerror(errno) << "\n";
+    }
+    return ok;
+}
+
+
+#ifndef GEN_DATA_NO_MAIN
+int main(int argc, char* argv[]) {
+    if (argc != 4) {
+        std::cerr << "usage: gen_data dat|csv n_rows path\n";
+        return EXIT_FAILURE;
+    }
+    return generate(argv[1], std::stoul(argv[2]), argv[3]) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+#endif
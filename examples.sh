@@ -11,16 +11,107 @@
 #               the points (1,4), (2,5), and (3,6).
 # --line, -L:   adds a line layer
 # --bar, -B:    adds a bar layer
+# --histogram, -H: adds a histogram layer, counting -x in --bins equal-width bins
+#               (default 30), or bins of --binwidth. The counts are computed
+#               in-process, and only the bins are sent to gnuplot. A layer has
+#               at most 1048576 (2^20) bins.
+# --bin2d, -D:  adds a 2d bin layer, counting the (-x, -y) points in a grid of
+#               --bins cells (one value, or "x,y") drawn as an image with the
+#               --palette (a gnuplot palette, e.g. "rgbformulae 7,5,15"). The
+#               grid has at most 2^20 cells.
+# --smooth, -S: adds a smoothed line through (-x, -y), with a ribbon for its 95%
+#               confidence band (--se 0 to leave it out). --method is "loess"
+#               (--span 0.75), "lm" or "bin" (means in --bins bins, one pass over
+#               the data); by default loess below 1000 points, else bin.
 # --labs:       specifies the start of a "labels" layer, but doesn't take any
 #               input. LabelLayer specific settings should follow.
 # --theme:      specifies the start of a "theme" layer, but doesn't take any
 #               input. ThemeLayer specific settings should follow.
+# --facet:      draws the plot once per value of the -x column (gg facet_wrap(),
+#               --ncol panels per row), or per -y (rows) and -x (columns) value
+#               (gg facet_grid()), in a gnuplot multiplot. Layers reading a data
+#               file get its rows of each panel (the file is split in-process, in
+#               one pass); other layers (inline, stats) are drawn in every panel.
 # -x, -y:       specify the x and y settings for the layer - could identify variables,
 #               provide "in-line" data, or provide labels for a labels layer.
 # --shape:      specify the shape of the points in a point layer
-# --size:       specify the size of the points in a point layer
+# --size:       specify the size of the points in a point layer. A column expression
+#               (e.g. "(\$3)" or "(column('z'))") maps the size to that column,
+#               and --color (point and line layers) takes one the same way. The
+#               values are scaled in-process (sizes by area, colors to a fixed
+#               colormap) and sent as extra columns.
 # --linetype:   specify the line type in a line layer
 # --label:      specify the label to use for layer's legend item
+# --binary:     send "in-line" data to gnuplot as packed float64 records instead
+#               of text. Can be set on the global layer to apply to all layers.
+# --stream:     read the "in-line" data of a "-" layer from a file or named FIFO
+#               (or "-" for stdin) instead of -x/-y, which then select the columns.
+#               Data is forwarded to gnuplot in chunks as it arrives.
+# --load:       parse a layer's data file in-process (memory-mapped, in parallel)
+#               and send it to gnuplot once as a named datablock ($DATA) that
+#               every layer using the file reads, instead of gnuplot reading the
+#               file once per layer. Can be set on the global layer.
+#               Column expressions (e.g. -y "(\$2 - \$3)") are then computed
+#               in-process too, and only the computed columns are sent.
+#               Loaded columns are numbers: a layer plotting a text column (e.g.,
+#               dates or categories) is left to gnuplot to read from the file, or
+#               fails if the file is cached, computed from, or several files.
+# --cache:      keep loaded files in the given directory as columnar binary files
+#               (column names, min/max, float64 values), so a file plotted again
+#               is mapped instead of parsed; it is re-parsed when the file's size
+#               or mtime changes. Implies --load, and a layer's columns are sent
+#               to gnuplot in binary. Can be set on the global layer.
+# --xlim:       x axis limits "lo:hi" (either may be left out). Loaded files keep
+#               only the rows with x in range; with --cache, the cache file's
+#               per-zone (64K rows) min/max of x pick the zones to read, so a
+#               zoomed-in view of a huge file reads a few pages. Set on the
+#               global layer.
+# data files:   a layer's (or the global) file can name several files, as a glob
+#               ('metrics-*.dat', quoted) or a list ('a.dat,b.dat'): they are
+#               loaded in-process, every file parsed at once, and sent as one
+#               datablock, a list's files in order and a glob's sorted by name.
+# --merge:      merge the rows of such files by x instead (a k-way merge, for
+#               files that are each sorted by x). Can be set on the global layer.
+# --threads:    number of threads used to parse loaded files (default: one per core)
+# --downsample: reduce a line or point layer's data to about n points before it is
+#               sent to gnuplot (the file is loaded in-process). --downsample_method
+#               is "lttb" (default, keeps the shape; n >= 3) or "minmax" (keeps
+#               the envelope; n >= 2). --stream and --live layers aren't reduced.
+# --server:     run as a plot server on the given unix socket, keeping --workers
+#               (default 2) gnuplot processes warm. No layers are given. It serves
+#               at most --max_connections (default 64) at once, and drops a
+#               connection (killing its gnuplot, which is replaced) that takes
+#               more than --render_timeout ms (default 60000), e.g. a script
+#               left waiting on "pause -1".
+# --client:     compose the plot as usual, but have the server at the given socket
+#               render it instead of starting gnuplot. The server keeps the last
+#               --cache_entries (default 64) plots, so a repeated plot (same
+#               arguments, data files unchanged) isn't composed or rendered again.
+#               Relative paths (data files, --output) are read from the client's
+#               directory.
+# --script_cache: keep the scripts (and outputs) of plots in the given directory,
+#               so a repeated plot isn't composed (or, with --output, rendered) again.
+# --quiet:      print nothing on stdout and don't wait for enter (a window is left
+#               open by gnuplot -persist), for use in pipelines.
+# --script:     write the script (commands and data) to a file, a file descriptor
+#               ("fd:3") or stdout ("-", which implies --quiet) instead of running
+#               gnuplot, e.g. to render it on another machine.
+# --profile:    time each stage of the plot (arguments, each layer's compose, data
+#               loads and transforms, writing the script, gnuplot's render) with
+#               the bytes it handled, reported on stderr as "text" or "json".
+# --output:     render to a file rather than a window. The terminal is picked from
+#               the extension (.png, .svg, .pdf, ...) unless --terminal is given.
+# --batch:      render every plot spec in a manifest file, one spec per line
+#               (arguments as on the command line, each with its own --output),
+#               on --jobs gnuplot processes (default: one per core).
+# --live:       for a --stream layer, plot only the last n samples (lines) and
+#               redraw the plot as they arrive, at most --fps times a second (10).
+#               Columns are numbers, with -x 0 for the sample count.
+# --watch:      keep the plot open and follow its data files like tail -f: rows
+#               appended to a file are sent (to its datablock, with --load) and
+#               the plot is redrawn, at most once per --watch_interval ms (500).
+#               Appended rows of a --load file are filtered by --xlim like the
+#               rest. Needs a window (not --output); enter on the terminal exits.
 ./main \
     -G ./data/cubic.dat -x1 \
     -P '' -y3 --shape 7 --size 0.5 -c "black" --label "observed" \
@@ -29,6 +120,66 @@
     --labs -x "x" -y "x^3" --title "Simple Cubic Function" \
     --theme --legend_position "right"
 
+# same plot, but cubic.dat is read and parsed once (shared by the first two layers)
+./main \
+    -G ./data/cubic.dat -x1 --load \
+    -P '' -y3 --shape 7 --size 0.5 -c "black" --label "observed" \
+    -L '' -y2 --linewidth 1 -c "red" --label "true" \
+    --labs -x "x" -y "x^3" --title "Simple Cubic Function"
+
+# same in-line layer, sent as raw binary data (faster for many points)
+./main \
+    -L - -x"1,2,3,4,5" -y"1,8,27,64,125" --binary -c "blue" --label "x^3"
+
+
+# streaming data from stdin (or from a named FIFO, e.g. --stream /tmp/metrics)
+tail -n +2 ./data/cubic.dat | ./main \
+    -L - --stream - -x1 -y2 -c "red" --label "streamed"
+
+# a scrolling plot of the last 500 samples of live telemetry
+#> ./collect_metrics | ./main -L - --stream - -x 0 -y 1 --live 500 --fps 20 -c "red"
+
+# plot server: start once, then send it plots (e.g., from a dashboard)
+#> ./main --server /tmp/gg.sock --workers 4 &
+#> ./main --client /tmp/gg.sock -G ./data/cubic.dat -L '' -x1 -y2
+
+# the second run copies the cached output instead of plotting again
+#> ./main -G ./data/cubic.dat -L '' -x1 -y2 --output cubic.png --script_cache ~/.cache/gg
+#> ./main -G ./data/cubic.dat -L '' -x1 -y2 --output cubic.png --script_cache ~/.cache/gg
+
+# a live plot of a growing log (e.g., a process appending "step loss" rows)
+#> ./main -G ./train.log -x1 --load -L '' -y2 --watch --watch_interval 250
+
+# headless batch rendering
+#> cat reports.txt
+#> -G ./data/cubic.dat -x1 -L '' -y2 --output cubic.png
+#> -G ./data/test.csv --sep ',' -P '' -x x -y y --output test.svg
+#> ./main --batch reports.txt --jobs 4
+
+# a large file parsed once, then read from its columnar cache on later runs
+#> ./main -G ./big.dat -x1 --cache ~/.cache/gg/columns -P '' -y2
+
+# a zoomed-in view of it, reading only the cached rows in range
+#> ./main -G ./big.dat -x1 --cache ~/.cache/gg/columns --xlim 100000:170000 -P '' -y2
+
+# shards of one series, read at once and merged by x into one datablock
+#> ./main -G './metrics-*.dat' -x1 --merge -L '' -y2
+
+# the script for a remote gnuplot, nothing else on stdout
+#> ./main -G ./data/cubic.dat -x1 -L '' -y2 --output cubic.png --script - | ssh render gnuplot
+
+# where the time goes: our side (load, stats, write) or gnuplot's (render)
+#> ./main -G ./big.dat -x1 --load -H '' -x2 --output hist.png --profile text
+
+# a long series, downsampled to ~2000 points before plotting
+./main -G ./data/cubic.dat -x1 \
+    -L '' -y3 --downsample 2000 --downsample_method minmax -c "black"
+
+# a fitted trend through the noisy observations
+./main -G ./data/cubic.dat -x1 \
+    -P '' -y3 --shape 7 --size 0.5 -c "black" --label "observed" \
+    -S '' -y3 -c "#3366ff" --label "loess" \
+    --labs -x "x" -y "x^3" --title "Smoothed Cubic"
 
 # getting more creative in the column selection
 ./main -G "./data/cubic.dat" \
@@ -52,6 +203,21 @@
     --line "" -x "(log(\$1))" -y y \
     --labs --title "x on log-scale" -x "log(x)"
 
+# same, with the log computed in-process (only x and y are sent to gnuplot)
+./main -G "./data/cubic.dat" --load \
+    --line "" -x "(log(\$1))" -y y \
+    --labs --title "x on log-scale" -x "log(x)"
+
+# a histogram of the noisy y values
+./main -G ./data/cubic.dat \
+    -H '' -x3 --bins 20 -c "#4682b4" \
+    --labs -x "y" -y "count" --title "Histogram"
+
+# the density of an overplotted scatter, as counts in a 40 x 20 grid
+./main -G ./data/cubic.dat \
+    -D '' -x1 -y3 --bins 40,20 \
+    --labs --title "2D Bins"
+
 # a bar plot
 ./main \
     -G ./data/test.dat \
@@ -68,10 +234,11 @@
     # .....................................#AARRGGBB (alpha, red, green, blue)
 
 
-# TODO:
-# need to add support for specifying variables for aesthetics...
-#
-#   for example, try the following gnuplot command which lets the pointsize vary
-#   by the value of the second column and the color by the third column:
-#> gnuplot
-#> plot "data/cubic.dat" using 1:2:($2*0.01):($3*0.01) with points ps variable lt palette notitle
+# variable aesthetics: the size of the points by y, their color by z
+./main -G ./data/cubic.dat -x1 \
+    -P '' -y2 --shape 7 --size "(\$2)" -c "(column('z'))" \
+    --labs -x "x" -y "y" --title "Size and Color by Column"
+
+# small multiples: one panel per host, and a grid of region by host
+#> ./main -G ./metrics.csv --sep ',' -x time -L '' -y latency --facet -x host --ncol 3
+#> ./main -G ./metrics.csv --sep ',' -x time -L '' -y latency --facet -y region -x host
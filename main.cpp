@@ -11,11 +11,48 @@
 #include <iostream>
 #include <memory>
 #include <string>
+#include <string_view>
 #include <vector>
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <limits>
+#include <climits>
 #include <unordered_map>
+#include <deque>
+#include <queue>
+#include <list>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <variant>
+#include <array>
+#include <memory_resource>
+#include <chrono>
 #include <unistd.h>
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cctype>
+#include <cerrno>
+#include <fstream>
+#include <fcntl.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <poll.h>
+#include <csignal>
 #include <getopt.h>
+#include <glob.h>
 
 
 /*
@@ -37,42 +74,255 @@
 *   - generate any relevant "set" commands based on the updated states
 * The global state needs to:
 *   - warn if a key is set more than once
+*
+* Keys are a fixed set (Key), and their values are kept in a flat array indexed
+* by key, rather than hashed by name. Numeric settings are checked when they are
+* inserted (i.e., when the command line is parsed), and stored as numbers too.
+*/
+#define GG_KEYS(X) \
+    X(file, text) \
+    X(file_delim, text) \
+    X(stream, text) \
+    X(datablock, text) \
+    X(source, text) \
+    X(x_data, text) \
+    X(y_data, text) \
+    X(xlab, text) \
+    X(ylab, text) \
+    X(title, text) \
+    X(label, text) \
+    X(color, text) \
+    X(shape, text) \
+    X(size, text) \
+    X(linetype, text) \
+    X(linewidth, text) \
+    X(fillstyle, text) \
+    X(width, text) \
+    X(palette, text) \
+    X(ribbon, text) \
+    X(legend_position, text) \
+    X(legend_direction, text) \
+    X(binary, number) \
+    X(load, number) \
+    X(threads, number) \
+    X(downsample, number) \
+    X(downsample_method, text) \
+    X(live, number) \
+    X(bins, text) \
+    X(binwidth, text) \
+    X(method, text) \
+    X(span, number) \
+    X(se, number) \
+    X(facet_x, text) \
+    X(facet_y, text) \
+    X(ncol, number) \
+    X(cache, text) \
+    X(xlim, text) \
+    X(merge, number)
+
+enum class Key {
+#define GG_KEY_ENUM(name, type) name,
+    GG_KEYS(GG_KEY_ENUM)
+#undef GG_KEY_ENUM
+};
+
+enum class KeyType { text, number };
+
+struct KeyInfo {
+    const char* name;
+    KeyType type;
+};
+
+const KeyInfo key_info[] = {
+#define GG_KEY_INFO(name, type) {#name, KeyType::type},
+    GG_KEYS(GG_KEY_INFO)
+#undef GG_KEY_INFO
+};
+
+const size_t n_keys = sizeof(key_info) / sizeof(key_info[0]);
+
+const char* key_name(Key key) { return key_info[static_cast<size_t>(key)].name; }
+
+// the aesthetic a column key selects, e.g. "x" for x_data
+std::string aes_name(Key key) {
+    std::string name = key_name(key);
+    return name.substr(0, name.rfind("_data"));
+}
+
+bool parse_double(std::string_view str, double& value);
+
+
+/* Plot arena
+* Composing a plot builds many short-lived strings: the environment values, the
+* set and plot commands of each layer, and the pieces they are joined from.
+* In server and batch mode that's thousands of plots a second, so each plot
+* has a monotonic arena that these are allocated from, and that is released in
+* one go when the plot is destroyed. Text is a string that lives in an arena.
+* While a plot is composed (see parse_plot()), its arena is the default
+* std::pmr resource, so temporaries land in it too.
 */
+using Text = std::pmr::string;
+
+// forwards to another resource, counting what is asked of it (one request at
+// a time while it's shared by threads)
+class CountingResource : public std::pmr::memory_resource {
+    private:
+        std::pmr::memory_resource* upstream;
+        std::mutex mutex;
+        void* do_allocate(size_t bytes, size_t alignment) override {
+            std::unique_lock<std::mutex> lock(mutex, std::defer_lock);
+            if (shared) {
+                lock.lock();
+            }
+            n_allocs++;
+            n_bytes += bytes;
+            return upstream->allocate(bytes, alignment);
+        }
+        void do_deallocate(void* p, size_t bytes, size_t alignment) override {
+            std::unique_lock<std::mutex> lock(mutex, std::defer_lock);
+            if (shared) {
+                lock.lock();
+            }
+            upstream->deallocate(p, bytes, alignment);
+        }
+        bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+            return this == &other;
+        }
+    public:
+        size_t n_allocs = 0, n_bytes = 0;
+        bool shared = false; // only changed while no other thread allocates
+        explicit CountingResource(std::pmr::memory_resource* upstream) : upstream(upstream) {}
+};
+
+class Arena {
+    private:
+        static const size_t initial_size = 16 << 10;
+        CountingResource heap{std::pmr::new_delete_resource()}; // blocks the arena takes
+        std::pmr::monotonic_buffer_resource buffer{initial_size, &heap};
+        CountingResource front{&buffer};                         // allocations it serves
+    public:
+        Arena() = default;
+        Arena(const Arena&) = delete;
+        Arena& operator=(const Arena&) = delete;
+        std::pmr::memory_resource* resource() { return &front; }
+        // while shared, threads other than the composing one may allocate
+        // from the arena (see prepare_layers())
+        void set_shared(bool shared) { front.shared = shared; }
+        size_t n_allocs() const { return front.n_allocs; }
+        size_t n_bytes() const { return front.n_bytes; }
+        size_t n_blocks() const { return heap.n_allocs; }
+};
+
+// makes an arena the default std::pmr resource while in scope
+// (not per thread - only used while a plot is composed, when the threads that
+// allocate Text do so from a shared arena, see Arena::set_shared())
+class ArenaScope {
+    private:
+        std::pmr::memory_resource* previous;
+    public:
+        explicit ArenaScope(Arena& arena)
+            : previous(std::pmr::set_default_resource(arena.resource())) {}
+        ~ArenaScope() { std::pmr::set_default_resource(previous); }
+        ArenaScope(const ArenaScope&) = delete;
+        ArenaScope& operator=(const ArenaScope&) = delete;
+};
+
 class Environment {
     private:
-        std::unordered_map<std::string, std::string> params;
+        struct Value {
+            Text text;
+            double number = 0;
+            bool set = false;
+            using allocator_type = std::pmr::polymorphic_allocator<char>;
+            explicit Value(const allocator_type& alloc) : text(alloc) {}
+            Value(const Value& other, const allocator_type& alloc)
+                : text(other.text, alloc), number(other.number), set(other.set) {}
+        };
+        std::pmr::vector<Value> values; // one per key, in the arena of the plot
+        Value& _value(Key key) { return values[static_cast<size_t>(key)]; }
+        const Value& _value(Key key) const { return values[static_cast<size_t>(key)]; }
+        static bool _parse(Key key, std::string_view _str, double& number) {
+            if (key_info[static_cast<size_t>(key)].type == KeyType::text) {
+                return true;
+            }
+            if (_str == "") {
+                number = 0;
+                return true;
+            }
+            return parse_double(_str, number);
+        }
+        void _set(Key key, std::string_view _str, double number) {
+            Value& v = _value(key);
+            v.text = _str;
+            v.number = number;
+            v.set = true;
+        }
     public:
-        void insert(const std::string key, const std::string& _str) {
-            if (params.find(key) != params.end()) {
-                std::cerr << "Warning: key '" << key << "' already set, ignoring\n";
-                return;
+        explicit Environment(std::pmr::memory_resource* resource = std::pmr::get_default_resource())
+            : values(n_keys, resource) {}
+        Environment(const Environment& other, std::pmr::memory_resource* resource)
+            : values(other.values, resource) {}
+
+        // false (with an error) if the value isn't valid for the key
+        bool insert(Key key, std::string_view _str) {
+            if (_value(key).set) {
+                std::cerr << "Warning: key '" << key_name(key) << "' already set, ignoring\n";
+                return true;
+            }
+            double number = 0;
+            if (!_parse(key, _str, number)) {
+                std::cerr << "Error: '" << key_name(key) << "' must be a number, got '" << _str << "'\n";
+                return false;
             }
-            params[key] = _str;
+            _set(key, _str, number);
+            return true;
         }
-        void fill(const std::string key, const std::string& _fill) {
-            if (params.find(key) == params.end()) {
-                params[key] = _fill;
+        void fill(Key key, std::string_view _fill) {
+            if (!_value(key).set) {
+                replace(key, _fill);
             }
         }
-        void replace(const std::string key, const std::string& _str) {
-            params[key] = _str;
+        void replace(Key key, std::string_view _str) {
+            double number = 0;
+            _parse(key, _str, number); // (values replaced by layers are known to be valid)
+            _set(key, _str, number);
         }
-        std::string get(const std::string key, const std::string _default = "") {
-            if (params.find(key) == params.end()) {
-                return _default;
+        // unset every key, keeping the memory of the values
+        void clear() {
+            for (Value& v : values) {
+                v.text.clear();
+                v.number = 0;
+                v.set = false;
             }
-            return params[key];
         }
+        bool has(Key key) const { return _value(key).set; }
+        // the value, or _default if it isn't set (a view of either)
+        std::string_view get(Key key, std::string_view _default = "") const {
+            const Value& v = _value(key);
+            return v.set ? std::string_view(v.text) : _default;
+        }
+        // the value of a numeric key
+        double number(Key key, double _default = 0) const {
+            const Value& v = _value(key);
+            return v.set ? v.number : _default;
+        }
+        // the value, or "" if it isn't set
+        const Text& operator[](Key key) const { return _value(key).text; }
 
-        std::string operator[](const std::string key) { return params[key]; };
-
-        //TODO: temporary
-        std::unordered_map<std::string, std::string> _params() { return params; }
+        // call fn(key, value) for each key that is set
+        template <typename Fn>
+        void for_each(Fn fn) const {
+            for (size_t i = 0; i < n_keys; i++) {
+                if (values[i].set) {
+                    fn(static_cast<Key>(i), std::string_view(values[i].text));
+                }
+            }
+        }
 };
 
 
-std::string mkvar(const std::string x) {
-    std::string y = x;
+Text mkvar(std::string_view x) {
+    Text y(x);
     // if y is wrapped in parentheses, it is a function call
     if (y.find("(") == 0) {
         return y;
@@ -84,418 +334,5745 @@ std::string mkvar(const std::string x) {
     return y;
 }
 
-std::string using_str_from_local(Environment& local) {
-    std::string file, x_data, y_data;
-    file = local.get("file");
-    if (file == "-") {
-        return "";
+// gnuplot binary clause for n_records inline records of n_cols float64 values
+Text binary_str(size_t n_records, size_t n_cols) {
+    Text format = "";
+    for (size_t i = 0; i < n_cols; i++) {
+        format += "%float64";
+    }
+    return "binary record=" + Text(std::to_string(n_records)) + " format='" + format + "'";
+}
+
+Text using_str_from_local(Environment& local, size_t n_inline = 0, size_t n_cols = 2) {
+    Text x_data, y_data;
+    std::string_view file = local.get(Key::file);
+    if (file == "-" && local.get(Key::stream) == "") {
+        Text columns = "using 1";
+        for (size_t i = 2; i <= n_cols; i++) {
+            columns += ":" + Text(std::to_string(i));
+        }
+        if (local.number(Key::binary) == 1) {
+            return binary_str(n_inline, n_cols) + " " + columns;
+        }
+        return (n_cols > 2) ? columns : "";
     }
-    x_data = mkvar( local.get("x_data") );
-    y_data = mkvar( local.get("y_data") );
+    x_data = mkvar( local.get(Key::x_data) );
+    y_data = mkvar( local.get(Key::y_data) );
 
     return "using " + x_data + ":" + y_data;
 }
 
 
-std::vector<std::string> parse_data(const std::string& data_str) {
-    std::vector<std::string> data;
-    size_t pos = 0;
-    while (pos < data_str.size()) {
-        size_t next_pos = data_str.find(',', pos);
-        if (next_pos == std::string::npos) {
-            next_pos = data_str.size(); // no comma found, next_pos is end of str
+/* Byte scanning
+* Finding the next delimiter, newline or quote is the inner loop of splitting
+* rows and fields. find_any() checks 32 (AVX2) or 16 (NEON) bytes at a time when
+* the CPU supports it, and falls back to a scalar loop for the rest. AVX2 is
+* picked at runtime, so the default build stays portable. simd_scan can be
+* turned off to compare against the scalar path.
+*/
+inline const char* find_any_scalar(const char* p, const char* end, char a, char b, char c, char d) {
+    for (; p < end; p++) {
+        char x = *p;
+        if (x == a || x == b || x == c || x == d) {
+            return p;
         }
-        data.push_back( data_str.substr(pos, next_pos - pos) );
+    }
+    return end;
+}
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define GG_SIMD_AVX2
+__attribute__((target("avx2")))
+const char* find_any_avx2(const char* p, const char* end, char a, char b, char c, char d) {
+    const __m256i va = _mm256_set1_epi8(a), vb = _mm256_set1_epi8(b);
+    const __m256i vc = _mm256_set1_epi8(c), vd = _mm256_set1_epi8(d);
+    while (end - p >= 32) {
+        __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+        __m256i hits = _mm256_or_si256(
+            _mm256_or_si256(_mm256_cmpeq_epi8(chunk, va), _mm256_cmpeq_epi8(chunk, vb)),
+            _mm256_or_si256(_mm256_cmpeq_epi8(chunk, vc), _mm256_cmpeq_epi8(chunk, vd)));
+        unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(hits));
+        if (mask != 0) {
+            return p + __builtin_ctz(mask);
+        }
+        p += 32;
+    }
+    return find_any_scalar(p, end, a, b, c, d);
+}
+#elif defined(__ARM_NEON)
+#define GG_SIMD_NEON
+const char* find_any_neon(const char* p, const char* end, char a, char b, char c, char d) {
+    const uint8x16_t va = vdupq_n_u8(a), vb = vdupq_n_u8(b);
+    const uint8x16_t vc = vdupq_n_u8(c), vd = vdupq_n_u8(d);
+    while (end - p >= 16) {
+        uint8x16_t chunk = vld1q_u8(reinterpret_cast<const uint8_t*>(p));
+        uint8x16_t hits = vorrq_u8(vorrq_u8(vceqq_u8(chunk, va), vceqq_u8(chunk, vb)),
+                                   vorrq_u8(vceqq_u8(chunk, vc), vceqq_u8(chunk, vd)));
+        // narrow to 4 bits per byte to get a 64 bit mask
+        uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(
+            vshrn_n_u16(vreinterpretq_u16_u8(hits), 4)), 0);
+        if (mask != 0) {
+            return p + (__builtin_ctzll(mask) >> 2);
+        }
+        p += 16;
+    }
+    return find_any_scalar(p, end, a, b, c, d);
+}
+#endif
+
+bool simd_supported() {
+#if defined(GG_SIMD_AVX2)
+    return __builtin_cpu_supports("avx2");
+#elif defined(GG_SIMD_NEON)
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool simd_scan = simd_supported();
+
+// the first of any of the bytes a, b, c, d in [p, end), or end if none (repeat
+// a byte to look for fewer)
+inline const char* find_any(const char* p, const char* end, char a, char b, char c, char d) {
+#if defined(GG_SIMD_AVX2)
+    if (simd_scan)
+        return find_any_avx2(p, end, a, b, c, d);
+#elif defined(GG_SIMD_NEON)
+    if (simd_scan)
+        return find_any_neon(p, end, a, b, c, d);
+#endif
+    return find_any_scalar(p, end, a, b, c, d);
+}
+
+// skip a double-quoted section starting at p (a '"'), returning the position
+// after the closing quote. Quotes don't span lines, so an unclosed quote ends
+// at the next newline (or end).
+inline const char* skip_quoted(const char* p, const char* end) {
+    const char* close = find_any(p + 1, end, '"', '\n', '"', '"');
+    return (close < end && *close == '"') ? close + 1 : close;
+}
+
+
+// split a comma-separated string into tokens. The tokens are views into
+// data_str, so they are only valid as long as it is.
+std::vector<std::string_view> parse_data(std::string_view data_str) {
+    std::vector<std::string_view> data;
+    data.reserve(std::count(data_str.begin(), data_str.end(), ',') + 1);
+    const char* pos = data_str.data();
+    const char* end = pos + data_str.size();
+    while (pos < end) {
+        // (end if no comma is found)
+        const char* next_pos = find_any(pos, end, ',', ',', ',', ',');
+        data.emplace_back(pos, next_pos - pos);
         pos = next_pos + 1;
     }
     return data;
 }
 
 
-// base class
-class Layer {
-    private:
-        bool composed = false;
-        bool inline_data = false;
-        std::vector<std::string> x;
-        std::vector<std::string> y;
+// parse a full string as a double (ignoring surrounding spaces), returning
+// false if it is not a number
+bool parse_double(std::string_view str, double& value) {
+    const char* begin = str.data();
+    const char* end = begin + str.size();
+    while (begin < end && std::isspace(static_cast<unsigned char>(*begin)))
+        begin++;
+    while (end > begin && std::isspace(static_cast<unsigned char>(end[-1])))
+        end--;
+    auto [ptr, ec] = std::from_chars(begin, end, value);
+    return ec == std::errc() && ptr == end && begin != end;
+}
 
-    protected:
-        Environment& global;
-        Environment& local;
-        void _fill_local(const std::string key, const std::string& _layer_default) {
-            // if key exists in local, do nothing. else, use global default if it
-            //   is set, else fill with the layer default
-            local.fill(key, global.get(key, _layer_default));
+
+// parse each comma-separated token of data_str as a double. Tokens that aren't
+// numbers are reported and stored as NaN, so the caller can drop those points.
+size_t parse_numbers(std::string_view data_str, std::vector<double>& values) {
+    std::vector<std::string_view> tokens = parse_data(data_str);
+    size_t n_invalid = 0;
+    values.resize(tokens.size());
+    for (size_t i = 0; i < tokens.size(); i++) {
+        if (!parse_double(tokens[i], values[i])) {
+            std::cerr << "Error: inline value '" << tokens[i] << "' is not numeric, skipping point\n";
+            values[i] = std::numeric_limits<double>::quiet_NaN();
+            n_invalid++;
         }
-        void _fill_global(const std::string key, const std::string& _layer_default) {
-            // if key exists in global, do nothing and send warning that the key
-            //   is already set.
-            // otherwise, fill with the local value if provided, or the layer default
-            global.insert(key, local.get(key, _layer_default));
+    }
+    return n_invalid;
+}
+
+
+// write the shortest representation of v that reads back as the same double,
+// returning the number of characters written (at most 32). Integral values
+// (indices, counts, timestamps, ...) are common in plot data, and are written
+// as integers directly rather than through the general shortest-digits search.
+size_t format_double(double v, char* buf) {
+    if (v == std::trunc(v) && std::fabs(v) < 9007199254740992.0 // 2^53
+        && !(v == 0 && std::signbit(v))) {
+        auto [ptr, ec] = std::to_chars(buf, buf + 32, static_cast<long long>(v));
+        return ptr - buf;
+    }
+    auto [ptr, ec] = std::to_chars(buf, buf + 32, v);
+    return ptr - buf;
+}
+
+
+// map a --sep argument to the delimiter character used when reading a file
+// (a space delimiter means any run of whitespace, as in gnuplot)
+char delim_char(std::string_view file_delim) {
+    if (file_delim == "" || file_delim == " " || file_delim == "whitespace") {
+        return ' ';
+    }
+    if (file_delim == "\\t" || file_delim == "tab") {
+        return '\t';
+    }
+    return file_delim[0];
+}
+
+
+// split one line of a data file into fields. Double-quoted fields may contain
+// the delimiter - the quotes are kept, see unquote().
+void split_fields(std::string_view line, char delim, std::vector<std::string_view>& fields) {
+    fields.clear();
+    const char* pos = line.data();
+    const char* end = pos + line.size();
+    if (delim != ' ') {
+        const char* start = pos;
+        while ((pos = find_any(pos, end, delim, '"', delim, delim)) < end) {
+            if (*pos == '"') {
+                pos = skip_quoted(pos, end);
+                continue;
+            }
+            fields.emplace_back(start, pos - start);
+            start = ++pos;
         }
-        std::string set_command = "";
-        std::string plot_command = "";
-        
-        // pure virtual functions - must be implemented by derived classes
-        virtual void _update_globals() = 0;
-        virtual void _update_locals() = 0;
-        virtual void _set_setters() = 0;
-        virtual void _set_plotcmd() = 0;
-        void _resolve_data_file() {
-            /*
-            If the local file is "", then the user is defaulting to the global file.
-            If that is also blank, then we error.
-            If the local file is something else, then the user is overriding the
-            global file or they are explicitly specifying a file for each layer.
-            Note - no reason to have a default file specified by layers because
-            a file string has to be given by the user (either a path, "", or "-")
-            */
-            std::string local_file, global_file, resolved_file;
-            local_file = local.get("file");
-            global_file = global.get("file");
-            if (local_file == "") {
-                if (global_file != "") {
-                    resolved_file = global_file;
-                } else {
-                    std::cerr << "Error: no global data set, nothing to use as default\n";
-                    resolved_file = "";
-                }
-            } else {
-                resolved_file = local_file;
-            } 
-            local.replace("file", resolved_file);
+        fields.emplace_back(start, end - start);
+        return;
+    }
+    while (pos < end) {
+        while (pos < end && (*pos == ' ' || *pos == '\t'))
+            pos++;
+        if (pos == end)
+            break;
+        const char* start = pos;
+        while ((pos = find_any(pos, end, ' ', '\t', '"', ' ')) < end && *pos == '"') {
+            pos = skip_quoted(pos, end);
         }
-        void _set_inline_data() {
-            if (local.get("file") == "-") {
-                inline_data = true;
-                x = parse_data(local["x_data"]);
-                y = parse_data(local["y_data"]);
+        fields.emplace_back(start, pos - start);
+    }
+}
+
+std::string unquote(std::string_view field) {
+    while (!field.empty() && std::isspace(static_cast<unsigned char>(field.front())))
+        field.remove_prefix(1);
+    while (!field.empty() && std::isspace(static_cast<unsigned char>(field.back())))
+        field.remove_suffix(1);
+    if (field.size() >= 2 && field.front() == '"' && field.back() == '"') {
+        field = field.substr(1, field.size() - 2);
+    }
+    return std::string(field);
+}
+
+// get the next line of text starting at pos (without the newline or a trailing
+// carriage return), and move pos past it
+std::string_view next_line(std::string_view text, size_t& pos) {
+    size_t end = text.find('\n', pos);
+    if (end == std::string_view::npos) {
+        end = text.size();
+    }
+    std::string_view line = text.substr(pos, end - pos);
+    pos = end + 1;
+    if (!line.empty() && line.back() == '\r') {
+        line.remove_suffix(1);
+    }
+    return line;
+}
+
+bool skip_line(std::string_view line) {
+    size_t first = line.find_first_not_of(" \t");
+    return first == std::string_view::npos || line[first] == '#';
+}
+
+
+// write all of a buffer, false on an error. On a non-blocking fd, waits for
+// room, and gives up at the deadline (if any).
+bool write_all(int fd, const char* buf, size_t n,
+               const std::chrono::steady_clock::time_point* deadline = nullptr) {
+    while (n > 0) {
+        ssize_t written = write(fd, buf, n);
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                return false;
+            int left = -1;
+            if (deadline != nullptr) {
+                left = static_cast<int>(std::max<int64_t>(0, std::chrono::duration_cast<std::chrono::milliseconds>(
+                    *deadline - std::chrono::steady_clock::now()).count()));
             }
+            pollfd pfd = {fd, POLLOUT, 0};
+            int ready = poll(&pfd, 1, left);
+            if (ready == 0 || (ready < 0 && errno != EINTR))
+                return false;
+            continue;
         }
-    public:
-        Layer(Environment& global, Environment& local)
-            : global(global), local(local) {}
+        buf += written;
+        n -= written;
+    }
+    return true;
+}
 
-        // compose the layer based on the current global and local states
-        void compose() {
-            // make all updates to shared objects
-            _update_globals();
-            _update_locals();
-            // make all updates to local objects
-            _set_setters();
-            _set_plotcmd();
-            _set_inline_data();
-            composed = true;
-        }
-        std::string get_set_line() {
-            if (!composed) {
-                std::cerr << "Error: layer not composed, cannot get set line\n";
-                return "";
+
+/* Profiling
+* With --profile, each stage of a plot (parsing the arguments, composing each
+* layer, loading and transforming data, writing the script and gnuplot's render)
+* is timed, along with the bytes it handled, and the stages are reported on
+* stderr at exit - as text, or as JSON with --profile json. Stages run within
+* others (e.g., a load within a layer's data) are listed, indented, under them,
+* even when they ran on another thread (see prepare_layers()).
+*/
+class Profiler {
+    private:
+        struct Stage {
+            std::string name, detail;
+            size_t parent; // the stage it ran within, none for npos
+            size_t depth;
+            double ms;
+            size_t bytes;
+        };
+        std::vector<Stage> stages; // in the order they started
+        std::mutex mutex;
+        bool on = false, json = false;
+        // the stages with each one's children (in the order they started) under
+        // it, so the listing doesn't depend on how threads interleaved them
+        std::vector<size_t> _tree_order() {
+            std::vector<std::vector<size_t>> children(stages.size() + 1); // (the last for top level)
+            for (size_t i = 0; i < stages.size(); i++) {
+                size_t parent = stages[i].parent;
+                children[parent == npos ? stages.size() : parent].push_back(i);
             }
-            return set_command;
-        }
-        std::string get_plot_line() {
-            if (!composed) {
-                std::cerr << "Error: layer not composed, cannot get plot line\n";
-                return "";
+            std::vector<size_t> order, pending(children.back().rbegin(), children.back().rend());
+            while (!pending.empty()) {
+                size_t i = pending.back();
+                pending.pop_back();
+                order.push_back(i);
+                pending.insert(pending.end(), children[i].rbegin(), children[i].rend());
             }
-            return plot_command;
+            return order;
         }
-        std::string get_inline_data() {
-            if (!composed) {
-                std::cerr << "Error: layer not composed, cannot get inline data\n";
-                return "";
+    public:
+        void enable(bool as_json) {
+            on = true;
+            json = as_json;
+        }
+        bool enabled() const { return on; }
+        static constexpr size_t npos = SIZE_MAX;
+        // reserve the next stage's place, within the parent stage (npos for
+        // none), filled in by finish()
+        size_t start(std::string name, std::string detail, size_t parent) {
+            std::lock_guard<std::mutex> lock(mutex);
+            size_t depth = (parent == npos) ? 0 : stages[parent].depth + 1;
+            stages.push_back(Stage{std::move(name), std::move(detail), parent, depth, 0, 0});
+            return stages.size() - 1;
+        }
+        void finish(size_t i, double ms, size_t bytes) {
+            std::lock_guard<std::mutex> lock(mutex);
+            stages[i].ms = ms;
+            stages[i].bytes = bytes;
+        }
+        void report(std::ostream& out) {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!on) {
+                return;
             }
-            std::string result = "";
-            if (inline_data) {
-                size_t y_size = y.size();
-                for (size_t i = 0; i < x.size(); i++) {
-                    if (i >= y_size) {
-                        break;
+            char buf[256];
+            std::vector<size_t> order = _tree_order();
+            if (json) {
+                out << "{\"stages\": [";
+                for (size_t i = 0; i < order.size(); i++) {
+                    const Stage& s = stages[order[i]];
+                    std::string detail;
+                    for (char c : s.detail) {
+                        if (c == '"' || c == '\\')
+                            detail += '\\';
+                        detail += c;
                     }
-                    result += x[i] + " " + y[i] + "\n";
+                    snprintf(buf, sizeof(buf), "\"depth\": %zu, \"ms\": %.3f, \"bytes\": %zu}",
+                             s.depth, s.ms, s.bytes);
+                    out << (i > 0 ? ",\n  " : "\n  ") << "{\"stage\": \"" << s.name << "\", \"detail\": \""
+                        << detail << "\", " << buf;
                 }
-                result += "e\n";
+                out << "\n]}\n";
+                return;
+            }
+            out << "Profile:\n";
+            for (size_t i : order) {
+                const Stage& s = stages[i];
+                std::string name = std::string(2 * s.depth, ' ') + s.name;
+                if (s.detail != "")
+                    name += " " + s.detail;
+                snprintf(buf, sizeof(buf), "  %-40s %10.3f ms", name.c_str(), s.ms);
+                out << buf;
+                if (s.bytes > 0) {
+                    snprintf(buf, sizeof(buf), " %12zu bytes %10.1f MB/s", s.bytes,
+                             s.ms > 0 ? s.bytes / s.ms / 1e3 : 0.0);
+                    out << buf;
+                }
+                out << "\n";
             }
-            return result;
         }
 };
 
+Profiler& profiler() {
+    static Profiler p;
+    return p;
+}
 
-/* Base Layer
-* The base layer is a special layer that can only be included once at the start
-* of the plot, where the user can define data and aesthetic options that will then
-* apply to any preceding layer, unless overwritten. This is equivalent to ggplot()
-* in ggplot2 - e.g.,
-* `ggplot(data = data, aes(x = x, y = y, color = color)) + geom_point(aes(shape = shape))`
-* defines a data set and aesthetics to be used for all preceding layers.
-* 
-*/
-class BaseLayer : public Layer {
-    protected:
-        std::string gd_file_delim = " "; // "global default -> gd"
-        std::string gd_x_data = "1";
-        std::string gd_y_data = "1";
-        std::string gd_color = "black";
-        std::string gd_shape = "1";
+// times a stage from its construction to its destruction, if profiling. A
+// stage is within the innermost one running on its thread, unless its parent
+// is given (for a task run on a thread pool, see current())
+class StageTimer {
+    private:
+        static thread_local size_t running; // innermost stage on this thread, or npos
+        bool on;
+        size_t index = 0, outer = Profiler::npos;
+        std::chrono::steady_clock::time_point start;
     public:
-        using Layer::Layer;
-        void _update_globals() override {
-            if (local.get("file") == "-") {
-                std::cerr << "Error: the base layer cannot use inline data, ignoring\n";
-                global.insert("file", "");
-            } else {
-                global.insert("file", local.get("file", ""));
+        size_t bytes = 0; // handled by the stage, if it's known
+        explicit StageTimer(std::string name, std::string detail = "")
+            : StageTimer(std::move(name), std::move(detail), running) {}
+        StageTimer(std::string name, std::string detail, size_t parent) : on(profiler().enabled()) {
+            if (on) {
+                outer = running;
+                index = running = profiler().start(std::move(name), std::move(detail), parent);
+                start = std::chrono::steady_clock::now();
             }
-            _fill_global("file_delim", gd_file_delim);
-            _fill_global("x_data", gd_x_data);
-            _fill_global("y_data", gd_y_data);
-            _fill_global("color", gd_color);
-            _fill_global("shape", gd_shape);
-        };
-        void _update_locals() override {
-            return;
-        };
-        void _set_setters() override {
-            set_command += "set datafile separator '" + global["file_delim"] + "'\n";
-        };
-        void _set_plotcmd() override {
-            return;
-        };
+        }
+        StageTimer(const StageTimer&) = delete;
+        StageTimer& operator=(const StageTimer&) = delete;
+        ~StageTimer() {
+            if (on) {
+                running = outer;
+                std::chrono::duration<double, std::milli> ms = std::chrono::steady_clock::now() - start;
+                profiler().finish(index, ms.count(), bytes);
+            }
+        }
+        // the innermost stage running on this thread, to pass as the parent of
+        // stages started on others
+        static size_t current() { return running; }
 };
 
+thread_local size_t StageTimer::running = Profiler::npos;
 
+// reports the profile (if profiling) when it goes out of scope
+struct ProfileReport {
+    ~ProfileReport() { profiler().report(std::cerr); }
+};
 
-// Labs layer (E.g., for axis labels)
-class LabsLayer : public Layer {
-    protected:
-        std::string gd_title = "";
-        std::string gd_xlab = "x";
-        std::string gd_ylab = "y";
+
+/* PipeWriter
+* Pipelined output to gnuplot. Everything that is sent (set lines, the plot
+* command, data) is written into fixed-size chunks, and a writer thread sends
+* full chunks with large write() calls while the next one is being filled, so
+* generating data overlaps with gnuplot reading it. At most max_chunks are held:
+* when gnuplot falls behind the producer waits (backpressure) rather than
+* buffering more, so memory use doesn't grow with the size of the payload.
+* A writer can also target a string instead, e.g. to send a script elsewhere.
+*/
+class PipeWriter {
+    private:
+        static const size_t chunk_size = 1 << 20;
+        static const size_t max_chunks = 4;
+        int fd = -1;
+        std::string* target = nullptr;
+        std::string chunk; // being filled
+        std::deque<std::string> queue; // full chunks waiting to be written
+        std::vector<std::string> spare; // written chunks, reused
+        std::mutex mutex;
+        std::condition_variable cv;
+        bool writing = false, stopping = false, failed = false;
+        bool has_deadline = false;
+        std::chrono::steady_clock::time_point deadline; // (see set_deadline())
+        size_t n_bytes = 0;
+        std::thread thread;
+        void _run() {
+            std::unique_lock<std::mutex> lock(mutex);
+            while (true) {
+                cv.wait(lock, [this] { return stopping || !queue.empty(); });
+                if (queue.empty())
+                    return;
+                std::string out = std::move(queue.front());
+                queue.pop_front();
+                writing = true;
+                bool skip = failed;
+                const std::chrono::steady_clock::time_point* until = has_deadline ? &deadline : nullptr;
+                lock.unlock();
+                bool ok = skip || write_all(fd, out.data(), out.size(), until);
+                lock.lock();
+                failed = failed || !ok;
+                writing = false;
+                out.clear();
+                spare.push_back(std::move(out));
+                cv.notify_all();
+            }
+        }
+        std::string& _buffer() { return target != nullptr ? *target : chunk; }
+        // queue the current chunk for writing, waiting while the queue is full
+        void _hand_over() {
+            if (target != nullptr || chunk.empty())
+                return;
+            std::unique_lock<std::mutex> lock(mutex);
+            cv.wait(lock, [this] { return queue.size() < max_chunks; });
+            queue.push_back(std::move(chunk));
+            chunk = std::string();
+            if (!spare.empty()) {
+                chunk = std::move(spare.back());
+                spare.pop_back();
+            }
+            chunk.reserve(chunk_size);
+            cv.notify_all();
+        }
     public:
-        using Layer::Layer;
-        void _update_globals() override {
-            _fill_global("title", gd_title);
-            _fill_global("xlab", gd_xlab);
-            _fill_global("ylab", gd_ylab);
-            return;
+        explicit PipeWriter(int fd) : fd(fd), thread(&PipeWriter::_run, this) {
+            chunk.reserve(chunk_size);
         }
-        void _update_locals() override {
-            return;
+        explicit PipeWriter(std::string& target) : target(&target) {}
+        PipeWriter(const PipeWriter&) = delete;
+        PipeWriter& operator=(const PipeWriter&) = delete;
+        ~PipeWriter() {
+            finish();
+            if (thread.joinable()) {
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    stopping = true;
+                }
+                cv.notify_all();
+                thread.join();
+            }
         }
-        void _set_setters() override {
-            set_command += "set title '" + global["title"] + "'\n";
-            set_command += "set xlabel '" + global["xlab"] + "'\n";
-            set_command += "set ylabel '" + global["ylab"] + "'\n";
+
+        void write(const char* data, size_t n) {
+            n_bytes += n;
+            while (n > 0) {
+                std::string& buf = _buffer();
+                size_t room = (target != nullptr) ? n : std::min(n, chunk_size - buf.size());
+                buf.append(data, room);
+                data += room;
+                n -= room;
+                if (n > 0) {
+                    _hand_over();
+                }
+            }
         }
-        void _set_plotcmd() override {
-            return;
+        void write(std::string_view str) { write(str.data(), str.size()); }
+        void put(char c) { write(&c, 1); }
+        // space for formatting up to n bytes in place; commit() how many were used
+        char* claim(size_t n) {
+            std::string& buf = _buffer();
+            if (target == nullptr && buf.size() + n > chunk_size) {
+                _hand_over();
+            }
+            std::string& out = _buffer();
+            size_t used = out.size();
+            out.resize(used + n);
+            return &out[used];
+        }
+        void commit(char* start, size_t used) {
+            std::string& buf = _buffer();
+            buf.resize(start - buf.data() + used);
+            n_bytes += used;
+        }
+        // fail the writes that haven't finished by a deadline (the rest of the
+        // output is then dropped), if the fd is non-blocking
+        void set_deadline(std::chrono::steady_clock::time_point until) {
+            std::lock_guard<std::mutex> lock(mutex);
+            deadline = until;
+            has_deadline = true;
+        }
+        // send what has been written so far, without waiting for it to arrive
+        void flush() { _hand_over(); }
+        // send everything and wait until it has been written, false on an error
+        bool finish() {
+            _hand_over();
+            if (!thread.joinable()) {
+                return true;
+            }
+            std::unique_lock<std::mutex> lock(mutex);
+            cv.wait(lock, [this] { return queue.empty() && !writing; });
+            return !failed;
         }
+        size_t bytes_written() const { return n_bytes; }
 };
 
 
-// Theme Layer (E.g., for legend position)
-class ThemeLayer : public Layer {
-    protected:
+/* DataFrame
+* A minimal column store for data that is handled in-process (inline data, or
+* files loaded with --load) rather than passed through to gnuplot as text: one
+* contiguous vector of doubles per column, so the numbers can be validated,
+* transformed or summarised before gnuplot sees them. Missing or non-numeric
+* values are NaN; a column of text (e.g., dates or categories) is marked, as
+* it's all NaN, and can't be plotted from the frame.
+*/
+class DataFrame {
+    private:
+        std::vector<std::string> names;
+        std::vector<std::vector<double>> columns;
+        std::vector<char> texts; // whether each column is text, see mark_text()
+    public:
+        size_t ncol() const { return columns.size(); }
+        size_t nrow() const { return columns.empty() ? 0 : columns[0].size(); }
+        const std::string& name(size_t i) const { return names[i]; }
+        std::vector<double>& column(size_t i) { return columns[i]; }
+        const std::vector<double>& column(size_t i) const { return columns[i]; }
+        std::vector<double>& add_column(const std::string& name, std::vector<double> values = {}) {
+            names.push_back(name);
+            columns.push_back(std::move(values));
+            return columns.back();
+        }
+        // a column whose fields were all text, rather than numbers or missing
+        bool is_text(size_t i) const { return i < texts.size() && texts[i]; }
+        void mark_text(size_t i) {
+            texts.resize(ncol(), 0);
+            texts[i] = 1;
+        }
+        // find a column by 1-based index (as in gnuplot's "using 1:2") or by
+        // name, returning -1 if there is no such column
+        int find(const std::string& var) const {
+            if (!var.empty() && var.find_first_not_of("0123456789") == std::string::npos) {
+                size_t ix = 0;
+                bool in_range = std::from_chars(var.data(), var.data() + var.size(), ix).ec == std::errc();
+                return (in_range && ix >= 1 && ix <= ncol()) ? static_cast<int>(ix - 1) : -1;
+            }
+            for (size_t i = 0; i < names.size(); i++) {
+                if (names[i] == var) {
+                    return static_cast<int>(i);
+                }
+            }
+            return -1;
+        }
+        // drop the rows that have a NaN in any column
+        void drop_nan() {
+            size_t n = nrow(), kept = 0;
+            for (size_t i = 0; i < n; i++) {
+                bool ok = true;
+                for (const auto& col : columns) {
+                    ok = ok && !std::isnan(col[i]);
+                }
+                if (!ok)
+                    continue;
+                for (auto& col : columns) {
+                    col[kept] = col[i];
+                }
+                kept++;
+            }
+            for (auto& col : columns) {
+                col.resize(kept);
+            }
+        }
+        // a line of the column names (quoted), if the columns have names
+        void write_names(PipeWriter& out, char delim) const {
+            bool named = false;
+            for (size_t j = 0; j < ncol(); j++) {
+                named = named || names[j] != "";
+            }
+            if (named) {
+                for (size_t j = 0; j < ncol(); j++) {
+                    out.write((j > 0 ? std::string(1, delim) : "") + "\"" + names[j] + "\"");
+                }
+                out.put('\n');
+            }
+        }
+        // rows of delimited values, as gnuplot reads them from a data file
+        void write_text(PipeWriter& out, char delim) const {
+            size_t n = nrow(), k = ncol();
+            for (size_t i = 0; i < n; i++) {
+                char* start = out.claim(k * 33);
+                char* pos = start;
+                for (size_t j = 0; j < k; j++) {
+                    if (j > 0) {
+                        *pos++ = delim;
+                    }
+                    pos += format_double(columns[j][i], pos);
+                }
+                *pos++ = '\n';
+                out.commit(start, pos - start);
+            }
+        }
+        // interleaved float64 records, for gnuplot's binary format='%float64...'
+        void write_binary(PipeWriter& out) const {
+            size_t n = nrow(), k = ncol();
+            for (size_t i = 0; i < n; i++) {
+                char* pos = out.claim(k * sizeof(double));
+                for (size_t j = 0; j < k; j++) {
+                    std::memcpy(pos + j * sizeof(double), &columns[j][i], sizeof(double));
+                }
+                out.commit(pos, k * sizeof(double));
+            }
+        }
+};
+
+
+/* ThreadPool
+* A fixed set of worker threads for splitting data work (e.g. parsing a file in
+* chunks) across cores. parallel_for() runs on the calling thread as well as the
+* workers, so it still makes progress if every worker is busy.
+*/
+class ThreadPool {
+    private:
+        std::vector<std::thread> workers;
+        std::deque<std::function<void()>> tasks;
+        std::mutex mutex;
+        std::condition_variable cv;
+        bool stopping = false;
+        void _work() {
+            while (true) {
+                std::function<void()> task;
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    cv.wait(lock, [this] { return stopping || !tasks.empty(); });
+                    if (tasks.empty())
+                        return;
+                    task = std::move(tasks.front());
+                    tasks.pop_front();
+                }
+                task();
+            }
+        }
+    public:
+        explicit ThreadPool(size_t n_threads = 0) {
+            if (n_threads == 0) {
+                n_threads = std::max(1u, std::thread::hardware_concurrency());
+            }
+            for (size_t i = 0; i < n_threads; i++) {
+                workers.emplace_back(&ThreadPool::_work, this);
+            }
+        }
+        ~ThreadPool() {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stopping = true;
+            }
+            cv.notify_all();
+            for (auto& worker : workers) {
+                worker.join();
+            }
+        }
+        ThreadPool(const ThreadPool&) = delete;
+        ThreadPool& operator=(const ThreadPool&) = delete;
+
+        size_t size() const { return workers.size(); }
+        void submit(std::function<void()> task) {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                tasks.push_back(std::move(task));
+            }
+            cv.notify_one();
+        }
+        // run fn(i) for every i in [0, n) and wait for all of them to finish
+        void parallel_for(size_t n, const std::function<void(size_t)>& fn) {
+            struct State {
+                std::atomic<size_t> next{0};
+                size_t done = 0;
+                std::mutex mutex;
+                std::condition_variable cv;
+            };
+            // shared, since helper tasks may only start after this returns
+            auto state = std::make_shared<State>();
+            auto run = [state, n, &fn]() {
+                size_t i, ran = 0;
+                while ((i = state->next++) < n) {
+                    fn(i);
+                    ran++;
+                }
+                if (ran > 0) {
+                    std::lock_guard<std::mutex> lock(state->mutex);
+                    state->done += ran;
+                    state->cv.notify_all();
+                }
+            };
+            size_t n_helpers = std::min(n, size() + 1) - 1;
+            for (size_t i = 0; i < n_helpers; i++) {
+                // (a helper that starts late finds no work left, never touching fn)
+                submit([state, n, run]() { if (state->next < n) run(); });
+            }
+            run();
+            std::unique_lock<std::mutex> lock(state->mutex);
+            state->cv.wait(lock, [&state, n] { return state->done == n; });
+        }
+};
+
+
+/* MappedFile
+* Read-only view of a whole file, memory-mapped when possible. Files that can't
+* be mapped (pipes, FIFOs) are read into memory instead.
+*/
+class MappedFile {
+    private:
+        void* addr = MAP_FAILED;
+        size_t length = 0;
+        std::string buffer;
+    public:
+        MappedFile() = default;
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+        ~MappedFile() {
+            if (addr != MAP_FAILED) {
+                munmap(addr, length);
+            }
+        }
+        bool open(const std::string& path) {
+            int fd = ::open(path.c_str(), O_RDONLY);
+            if (fd < 0) {
+                std::cerr << "Error: could not open data file '" << path << "': "
+                          << std::strerror(errno) << "\n";
+                return false;
+            }
+            struct stat st;
+            if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+                length = st.st_size;
+                addr = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (addr != MAP_FAILED) {
+                    madvise(addr, length, MADV_SEQUENTIAL);
+                    close(fd);
+                    return true;
+                }
+            }
+            // not mappable - read it
+            char chunk[1 << 16];
+            ssize_t n;
+            while ((n = read(fd, chunk, sizeof(chunk))) != 0) {
+                if (n < 0) {
+                    if (errno == EINTR)
+                        continue;
+                    std::cerr << "Error: reading data file '" << path << "': "
+                              << std::strerror(errno) << "\n";
+                    close(fd);
+                    return false;
+                }
+                buffer.append(chunk, n);
+            }
+            close(fd);
+            return true;
+        }
+        std::string_view text() const {
+            if (addr != MAP_FAILED) {
+                return std::string_view(static_cast<const char*>(addr), length);
+            }
+            return buffer;
+        }
+};
+
+
+// parse the first (non-comment) row of a data file, which sets the number of
+// columns. If it isn't numeric it is taken as the column names, with any quotes
+// removed (e.g. "x" "y" "z"), and pos is moved past it.
+void parse_header(std::string_view text, size_t& pos, char delim, DataFrame& df) {
+    std::vector<std::string_view> fields;
+    double value;
+    while (pos < text.size()) {
+        size_t line_start = pos;
+        std::string_view line = next_line(text, pos);
+        if (skip_line(line))
+            continue;
+        split_fields(line, delim, fields);
+        bool header = false;
+        for (const auto& field : fields) {
+            header = header || !parse_double(field, value);
+        }
+        for (const auto& field : fields) {
+            df.add_column(header ? unquote(field) : "");
+        }
+        if (!header) {
+            pos = line_start; // first row is data
+        }
+        return;
+    }
+}
+
+// parse rows of delimited values, appending them to columns (missing or
+// non-numeric values are NaN), and counting each column's non-numeric fields
+// in n_text, if given. Fields are found by scanning the whole text for
+// delimiters and newlines, rather than line by line, so that the scans run
+// over long stretches of bytes.
+void parse_rows(std::string_view text, char delim, std::vector<std::vector<double>>& columns,
+                std::vector<size_t>* n_text = nullptr) {
+    const char* pos = text.data();
+    const char* end = pos + text.size();
+    const size_t n_cols = columns.size();
+    const bool ws = (delim == ' ');
+    // bytes ending a field: the delimiter(s), a newline or the start of a quote
+    const char d1 = ws ? ' ' : delim, d2 = ws ? '\t' : delim;
+    double value;
+    size_t j;
+    auto store = [&](const char* start, const char* stop) {
+        if (j < n_cols) {
+            if (!parse_double(std::string_view(start, stop - start), value)) {
+                value = std::numeric_limits<double>::quiet_NaN();
+                if (n_text != nullptr && stop > start)
+                    (*n_text)[j]++;
+            }
+            columns[j].push_back(value);
+        }
+        j++;
+    };
+    // at the end of a line (allowing a trailing carriage return)
+    auto at_eol = [end](const char* p) {
+        return p == end || *p == '\n' || (*p == '\r' && (p + 1 == end || p[1] == '\n'));
+    };
+    auto skip_blanks = [end](const char* p) {
+        while (p < end && (*p == ' ' || *p == '\t'))
+            p++;
+        return p;
+    };
+    while (pos < end) {
+        // start of a line: skip blank and comment lines
+        const char* first = skip_blanks(pos);
+        if (at_eol(first) || *first == '#') {
+            const char* nl = static_cast<const char*>(std::memchr(first, '\n', end - first));
+            pos = (nl != nullptr) ? nl + 1 : end;
+            continue;
+        }
+        j = 0;
+        if (ws)
+            pos = first;
+        while (true) {
+            const char* start = pos;
+            while ((pos = find_any(pos, end, d1, d2, '\n', '"')) < end && *pos == '"') {
+                pos = skip_quoted(pos, end);
+            }
+            store(start, pos);
+            if (ws) {
+                pos = skip_blanks(pos);
+                if (at_eol(pos))
+                    break;
+            } else if (pos < end && *pos == delim) {
+                pos++;
+            } else {
+                break;
+            }
+        }
+        for (; j < n_cols; j++) {
+            columns[j].push_back(std::numeric_limits<double>::quiet_NaN());
+        }
+        const char* nl = static_cast<const char*>(std::memchr(pos, '\n', end - pos));
+        pos = (nl != nullptr) ? nl + 1 : end;
+    }
+}
+
+// split the rows of a data file into newline-aligned chunks, for a thread pool
+// to work on in parallel (one chunk without one)
+const size_t parse_chunk_size = 1 << 20;
+
+std::vector<std::string_view> line_chunks(std::string_view body, ThreadPool* pool) {
+    size_t n_chunks = 1;
+    if (pool != nullptr) {
+        n_chunks = std::min(body.size() / parse_chunk_size + 1, 4 * (pool->size() + 1));
+    }
+    std::vector<std::string_view> chunks;
+    size_t start = 0;
+    for (size_t k = 1; k <= n_chunks && start < body.size(); k++) {
+        size_t end = (k == n_chunks) ? body.size() : body.size() / n_chunks * k;
+        end = std::max(end, start);
+        end = body.find('\n', end);
+        end = (end == std::string_view::npos) ? body.size() : end + 1;
+        chunks.push_back(body.substr(start, end - start));
+        start = end;
+    }
+    return chunks;
+}
+
+// parse the text of a data file into df. With a thread pool, the chunks of rows
+// are parsed in parallel and then joined.
+bool parse_table(std::string_view text, char delim, DataFrame& df, ThreadPool* pool = nullptr) {
+    df = DataFrame();
+    size_t pos = 0;
+    parse_header(text, pos, delim, df);
+    if (df.ncol() == 0) {
+        return false;
+    }
+    std::string_view body = text.substr(std::min(pos, text.size()));
+    std::vector<std::string_view> chunks = line_chunks(body, pool);
+
+    std::vector<std::vector<std::vector<double>>> parts(chunks.size(),
+        std::vector<std::vector<double>>(df.ncol()));
+    std::vector<std::vector<size_t>> n_text(chunks.size(), std::vector<size_t>(df.ncol(), 0));
+    auto parse_chunk = [&](size_t k) { parse_rows(chunks[k], delim, parts[k], &n_text[k]); };
+    if (pool != nullptr && chunks.size() > 1) {
+        pool->parallel_for(chunks.size(), parse_chunk);
+    } else if (!chunks.empty()) {
+        parse_chunk(0);
+    }
+
+    // join the chunks into one contiguous vector per column
+    std::vector<size_t> offsets(parts.size() + 1, 0);
+    for (size_t k = 0; k < parts.size(); k++) {
+        offsets[k + 1] = offsets[k] + parts[k][0].size();
+    }
+    for (size_t j = 0; j < df.ncol(); j++) {
+        df.column(j).resize(offsets.back());
+    }
+    auto join_chunk = [&](size_t k) {
+        for (size_t j = 0; j < df.ncol(); j++) {
+            std::copy(parts[k][j].begin(), parts[k][j].end(), df.column(j).begin() + offsets[k]);
+            std::vector<double>().swap(parts[k][j]);
+        }
+    };
+    if (pool != nullptr && parts.size() > 1) {
+        pool->parallel_for(parts.size(), join_chunk);
+    } else {
+        for (size_t k = 0; k < parts.size(); k++) {
+            join_chunk(k);
+        }
+    }
+    // a column with text but no numbers is text
+    for (size_t j = 0; j < df.ncol(); j++) {
+        size_t n = 0;
+        for (const auto& counts : n_text) {
+            n += counts[j];
+        }
+        const std::vector<double>& col = df.column(j);
+        if (n > 0 && std::all_of(col.begin(), col.end(), [](double v) { return std::isnan(v); })) {
+            df.mark_text(j);
+        }
+    }
+    return true;
+}
+
+bool read_table(const std::string& path, char delim, DataFrame& df, ThreadPool* pool = nullptr,
+                size_t* n_bytes = nullptr) {
+    MappedFile file;
+    if (!file.open(path)) {
+        return false;
+    }
+    if (n_bytes != nullptr) {
+        *n_bytes = file.text().size();
+    }
+    if (!parse_table(file.text(), delim, df, pool)) {
+        std::cerr << "Error: no data in '" << path << "'\n";
+        return false;
+    }
+    return true;
+}
+
+
+/* Columnar cache
+* Loaded files can be kept in a cache directory (--cache dir) as columnar binary
+* files, so that a file that is plotted again isn't parsed again: its cache file
+* is mapped and the columns are copied out whole. A cache file holds a header,
+* a directory of the columns, a zone map of each column, and then the float64
+* values of each column in turn (8-byte aligned):
+*
+*   header:  "GGCOLS3\n", source size, source mtime (ns), delimiter, rows,
+*            columns, rows per zone
+*   column:  type (0 = float64, 1 = text: all NaN), name length, min, max, name
+*            (padded to 8 bytes)
+*   zones:   min, max of each zone (run of rows) of each column
+*   data:    rows x float64 for each column
+*
+* With a row filter (--xlim), only the zones whose range overlaps it are read,
+* so a narrow range of a large file touches a few of its pages.
+* Cache files are named by a hash of the source's absolute path and delimiter,
+* and a cache file is rewritten when its source's size or mtime changes.
+*/
+uint64_t fnv1a(uint64_t hash, const void* data, size_t n) {
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    for (size_t i = 0; i < n; i++) {
+        hash = (hash ^ p[i]) * 1099511628211ull;
+    }
+    return hash;
+}
+
+std::string key_hex(uint64_t key) {
+    char buf[17];
+    snprintf(buf, sizeof(buf), "%016llx", static_cast<unsigned long long>(key));
+    return buf;
+}
+
+const char columnar_magic[8] = {'G', 'G', 'C', 'O', 'L', 'S', '3', '\n'};
+const size_t columnar_zone_rows = 1 << 16;
+
+struct ColumnarHeader {
+    char magic[8];
+    uint64_t source_size;
+    int64_t source_mtime;
+    uint64_t delim;
+    uint64_t n_rows;
+    uint64_t n_cols;
+    uint64_t zone_rows;
+};
+
+struct ColumnarColumn {
+    uint32_t type; // float64, or text (DataFrame columns are doubles, see is_text())
+    uint32_t name_size;
+    double min, max; // of the numbers, NaN if there are none
+};
+
+const uint32_t columnar_float64 = 0;
+const uint32_t columnar_text = 1;
+
+size_t pad8(size_t n) { return (n + 7) & ~size_t(7); }
+
+// the rows of a loaded file to keep: those whose value in column (by name or
+// 1-based number) is in [lo, hi]. No column keeps every row.
+struct RowFilter {
+    std::string column = "";
+    double lo = -std::numeric_limits<double>::infinity();
+    double hi = std::numeric_limits<double>::infinity();
+    bool operator==(const RowFilter& other) const {
+        return column == other.column && lo == other.lo && hi == other.hi;
+    }
+    bool keeps(double v) const { return v >= lo && v <= hi; }
+};
+
+// parse axis limits "lo:hi", either of which may be left out (unbounded)
+bool parse_limits(std::string_view text, double& lo, double& hi) {
+    size_t colon = text.find(':');
+    if (colon == std::string_view::npos) {
+        return false;
+    }
+    std::string_view a = text.substr(0, colon), b = text.substr(colon + 1);
+    lo = -std::numeric_limits<double>::infinity();
+    hi = std::numeric_limits<double>::infinity();
+    return (a.empty() || parse_double(a, lo)) && (b.empty() || parse_double(b, hi)) && lo <= hi;
+}
+
+// keep only the rows of df that pass the filter
+void filter_rows(DataFrame& df, const RowFilter& filter) {
+    int ix = df.find(filter.column);
+    if (filter.column == "" || ix < 0) {
+        return;
+    }
+    const std::vector<double> key = df.column(ix);
+    for (size_t j = 0; j < df.ncol(); j++) {
+        std::vector<double>& col = df.column(j);
+        size_t kept = 0;
+        for (size_t i = 0; i < key.size(); i++) {
+            if (filter.keeps(key[i]))
+                col[kept++] = col[i];
+        }
+        col.resize(kept);
+    }
+}
+
+// the range of the numbers in v, NaN if there are none
+void value_range(const double* v, size_t n, double& lo, double& hi) {
+    lo = hi = std::numeric_limits<double>::quiet_NaN();
+    for (size_t i = 0; i < n; i++) {
+        if (std::isnan(v[i]))
+            continue;
+        lo = std::isnan(lo) ? v[i] : std::min(lo, v[i]);
+        hi = std::isnan(hi) ? v[i] : std::max(hi, v[i]);
+    }
+}
+
+// the cache file of a data file in dir
+std::string columnar_path(const std::string& dir, const std::string& path, char delim) {
+    char buf[PATH_MAX];
+    std::string abs = (realpath(path.c_str(), buf) != nullptr) ? buf : path;
+    uint64_t hash = fnv1a(14695981039346656037ull, abs.data(), abs.size());
+    hash = fnv1a(hash, &delim, 1);
+    return dir + "/" + key_hex(hash) + ".ggc";
+}
+
+// the header a cache file of the data file at path would have now, false if
+// it isn't a regular file
+bool columnar_header(const std::string& path, char delim, ColumnarHeader& header) {
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) {
+        return false;
+    }
+    std::memcpy(header.magic, columnar_magic, sizeof(header.magic));
+    header.source_size = static_cast<uint64_t>(st.st_size);
+    header.source_mtime = static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+    header.delim = static_cast<unsigned char>(delim);
+    header.n_rows = header.n_cols = 0;
+    header.zone_rows = columnar_zone_rows;
+    return true;
+}
+
+// a * b + c, false if it overflows
+bool checked_size(size_t a, size_t b, size_t c, size_t& out) {
+    return !__builtin_mul_overflow(a, b, &out) && !__builtin_add_overflow(out, c, &out);
+}
+
+// read the columns of a cache file into df (only the rows that pass the
+// filter). False if there is none, or it isn't the cache of the source
+// described by expected (e.g., the source has changed).
+bool read_columnar(const std::string& cache_path, const ColumnarHeader& expected, DataFrame& df,
+                   const RowFilter& filter) {
+    struct stat st;
+    if (stat(cache_path.c_str(), &st) != 0) {
+        return false; // not cached yet
+    }
+    MappedFile file;
+    if (!file.open(cache_path)) {
+        return false;
+    }
+    std::string_view text = file.text();
+    ColumnarHeader header;
+    if (text.size() < sizeof(header)) {
+        return false;
+    }
+    std::memcpy(&header, text.data(), sizeof(header));
+    if (std::memcmp(header.magic, columnar_magic, sizeof(header.magic)) != 0
+        || header.source_size != expected.source_size || header.source_mtime != expected.source_mtime
+        || header.delim != expected.delim || header.zone_rows == 0) {
+        return false;
+    }
+    // the sizes the file gives are checked against its size before use, so a
+    // corrupt (or foreign) file is rejected rather than allocated for or read
+    // past its end
+    if (header.n_cols == 0 || header.n_cols > (text.size() - sizeof(header)) / sizeof(ColumnarColumn)
+        || header.n_rows > text.size() / sizeof(double)) {
+        return false;
+    }
+    // the column directory
+    size_t pos = sizeof(header);
+    std::vector<ColumnarColumn> cols(header.n_cols);
+    DataFrame names; // (to look up the filter's column)
+    for (size_t j = 0; j < header.n_cols; j++) {
+        if (text.size() < pos + sizeof(ColumnarColumn)) {
+            return false;
+        }
+        std::memcpy(&cols[j], text.data() + pos, sizeof(ColumnarColumn));
+        pos += sizeof(ColumnarColumn);
+        if ((cols[j].type != columnar_float64 && cols[j].type != columnar_text)
+            || cols[j].name_size > text.size() - pos
+            || text.size() < pos + pad8(cols[j].name_size)) {
+            return false;
+        }
+        names.add_column(std::string(text.substr(pos, cols[j].name_size)));
+        pos += pad8(cols[j].name_size);
+    }
+    size_t n_zones = header.n_rows / header.zone_rows + (header.n_rows % header.zone_rows != 0);
+    size_t zones_pos = pos;
+    size_t column_bytes = header.n_rows * sizeof(double); // (n_rows is checked above)
+    size_t n_zone_maps, end;
+    if (!checked_size(header.n_cols, n_zones, 0, n_zone_maps)
+        || !checked_size(n_zone_maps, 2 * sizeof(double), pos, pos)
+        || !checked_size(header.n_cols, column_bytes, pos, end) || text.size() < end) {
+        return false;
+    }
+    auto values = [&](size_t j) {
+        return reinterpret_cast<const double*>(text.data() + pos + j * column_bytes);
+    };
+
+    // the rows to read: every zone, or those of the filter's column that
+    // overlap its range (and then only the rows in range)
+    int key = (filter.column != "") ? names.find(filter.column) : -1;
+    std::vector<std::pair<size_t, size_t>> runs; // [first, last) rows to copy
+    size_t n_kept = 0;
+    for (size_t z = 0; z < n_zones; z++) {
+        size_t first = z * header.zone_rows;
+        size_t last = std::min<size_t>(first + header.zone_rows, header.n_rows);
+        if (key >= 0) {
+            double zone[2];
+            std::memcpy(zone, text.data() + zones_pos + (key * n_zones + z) * sizeof(zone), sizeof(zone));
+            if (std::isnan(zone[0]) || zone[1] < filter.lo || zone[0] > filter.hi)
+                continue;
+            if (!filter.keeps(zone[0]) || !filter.keeps(zone[1])) {
+                const double* x = values(key);
+                for (size_t i = first; i < last; i++) {
+                    if (!filter.keeps(x[i]))
+                        continue;
+                    if (!runs.empty() && runs.back().second == i) {
+                        runs.back().second++;
+                    } else {
+                        runs.emplace_back(i, i + 1);
+                    }
+                    n_kept++;
+                }
+                continue;
+            }
+        }
+        if (!runs.empty() && runs.back().second == first) {
+            runs.back().second = last;
+        } else {
+            runs.emplace_back(first, last);
+        }
+        n_kept += last - first;
+    }
+    df = DataFrame();
+    for (size_t j = 0; j < header.n_cols; j++) {
+        std::vector<double>& col = df.add_column(names.name(j), std::vector<double>(n_kept));
+        if (cols[j].type == columnar_text) {
+            df.mark_text(j);
+        }
+        double* out = col.data();
+        for (const auto& run : runs) {
+            std::memcpy(out, values(j) + run.first, (run.second - run.first) * sizeof(double));
+            out += run.second - run.first;
+        }
+    }
+    return true;
+}
+
+// write df as the cache file of the source described by header (written to a
+// temporary file first, so a reader never sees it half-written)
+bool write_columnar(const std::string& cache_path, ColumnarHeader header, const DataFrame& df) {
+    header.n_rows = df.nrow();
+    header.n_cols = df.ncol();
+    size_t n_zones = (header.n_rows + header.zone_rows - 1) / header.zone_rows;
+    std::string head(reinterpret_cast<const char*>(&header), sizeof(header));
+    std::vector<double> zones;
+    for (size_t j = 0; j < df.ncol(); j++) {
+        const std::vector<double>& values = df.column(j);
+        ColumnarColumn col = {df.is_text(j) ? columnar_text : columnar_float64,
+                              static_cast<uint32_t>(df.name(j).size()),
+                              std::numeric_limits<double>::quiet_NaN(), std::numeric_limits<double>::quiet_NaN()};
+        for (size_t z = 0; z < n_zones; z++) {
+            size_t first = z * header.zone_rows;
+            double lo, hi;
+            value_range(values.data() + first, std::min<size_t>(header.zone_rows, values.size() - first), lo, hi);
+            zones.push_back(lo);
+            zones.push_back(hi);
+            if (!std::isnan(lo)) {
+                col.min = std::isnan(col.min) ? lo : std::min(col.min, lo);
+                col.max = std::isnan(col.max) ? hi : std::max(col.max, hi);
+            }
+        }
+        head.append(reinterpret_cast<const char*>(&col), sizeof(col));
+        head += df.name(j);
+        head.resize(pad8(head.size()), '\0');
+    }
+    head.append(reinterpret_cast<const char*>(zones.data()), zones.size() * sizeof(double));
+    std::string tmp = cache_path + ".tmp" + std::to_string(getpid());
+    int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        return false;
+    }
+    bool ok = write_all(fd, head.data(), head.size());
+    for (size_t j = 0; ok && j < df.ncol(); j++) {
+        ok = write_all(fd, reinterpret_cast<const char*>(df.column(j).data()), df.nrow() * sizeof(double));
+    }
+    ok = (close(fd) == 0) && ok;
+    if (!ok || rename(tmp.c_str(), cache_path.c_str()) != 0) {
+        unlink(tmp.c_str());
+        return false;
+    }
+    return true;
+}
+
+// read a data file through the cache in dir: from its cache file if it is
+// current, else by parsing it (and then caching it). Only the rows that pass
+// the filter are kept.
+bool read_cached_table(const std::string& path, const std::string& dir, char delim, DataFrame& df,
+                       const RowFilter& filter, ThreadPool* pool = nullptr, size_t* n_bytes = nullptr) {
+    ColumnarHeader header;
+    if (!columnar_header(path, delim, header)) {
+        if (!read_table(path, delim, df, pool, n_bytes)) { // e.g., a pipe
+            return false;
+        }
+        filter_rows(df, filter);
+        return true;
+    }
+    std::string cache_path = columnar_path(dir, path, delim);
+    if (read_columnar(cache_path, header, df, filter)) {
+        if (n_bytes != nullptr) {
+            *n_bytes = header.source_size;
+        }
+        return true;
+    }
+    if (!read_table(path, delim, df, pool, n_bytes)) {
+        return false;
+    }
+    mkdir(dir.c_str(), 0755); // (may exist already)
+    if (!write_columnar(cache_path, header, df)) {
+        std::cerr << "Warning: could not write cache file '" << cache_path << "': "
+                  << std::strerror(errno) << "\n";
+    }
+    filter_rows(df, filter);
+    return true;
+}
+
+
+/* Multi-file sources
+* A data file argument can name several files (e.g., shards of one series): a
+* glob ("metrics-*.dat") or a comma-separated list ("a.dat,b.dat"). They are
+* loaded in-process as one dataset - every file mapped and parsed at once on the
+* thread pool - and their rows taken one file after another (a list in its
+* order, a glob's matches sorted by name), or with --merge, merged by x: a
+* k-way merge of files that are each sorted by x.
+*/
+// whether a data file argument names several files (a file that exists by the
+// name is always just that file)
+bool is_multi_source(std::string_view source) {
+    if (source == "" || source == "-" || source.find_first_of("*?[,") == std::string_view::npos) {
+        return false;
+    }
+    struct stat st;
+    return stat(std::string(source).c_str(), &st) != 0;
+}
+
+// the files of a multi-file source, in order. False (with an error, unless
+// quiet) if a glob matches nothing.
+bool expand_source(const std::string& source, std::vector<std::string>& paths, bool quiet = false) {
+    paths.clear();
+    size_t pos = 0;
+    while (pos <= source.size()) {
+        size_t end = std::min(source.find(',', pos), source.size());
+        std::string part = source.substr(pos, end - pos);
+        pos = end + 1;
+        if (part == "")
+            continue;
+        if (part.find_first_of("*?[") == std::string::npos) {
+            paths.push_back(part);
+            continue;
+        }
+        glob_t matches;
+        if (glob(part.c_str(), 0, nullptr, &matches) != 0) {
+            if (!quiet)
+                std::cerr << "Error: no files match '" << part << "'\n";
+            globfree(&matches);
+            return false;
+        }
+        for (size_t i = 0; i < matches.gl_pathc; i++) {
+            paths.push_back(matches.gl_pathv[i]);
+        }
+        globfree(&matches);
+    }
+    if (paths.empty()) {
+        if (!quiet)
+            std::cerr << "Error: no files in '" << source << "'\n";
+        return false;
+    }
+    return true;
+}
+
+// read the files of a multi-file source into one frame, keeping the rows that
+// pass the filter - one file after another, or merged by merge_column if it is
+// given. Each file is read through the columnar cache in cache_dir, if given.
+// False if a file can't be read, or doesn't have the columns of the first.
+bool read_sources(const std::string& source, char delim, DataFrame& df, const RowFilter& filter,
+                  const std::string& merge_column, ThreadPool& pool, const std::string& cache_dir = "",
+                  size_t* n_bytes = nullptr) {
+    std::vector<std::string> paths;
+    if (!expand_source(source, paths)) {
+        return false;
+    }
+    std::vector<DataFrame> parts(paths.size());
+    std::vector<size_t> bytes(paths.size(), 0);
+    std::vector<char> ok(paths.size(), 0);
+    pool.parallel_for(paths.size(), [&](size_t i) {
+        ok[i] = (cache_dir != "")
+            ? read_cached_table(paths[i], cache_dir, delim, parts[i], filter, &pool, &bytes[i])
+            : read_table(paths[i], delim, parts[i], &pool, &bytes[i]);
+        if (ok[i] && cache_dir == "") {
+            filter_rows(parts[i], filter);
+        }
+    });
+    size_t n_rows = 0;
+    for (size_t i = 0; i < parts.size(); i++) {
+        if (!ok[i]) {
+            return false;
+        }
+        bool same = parts[i].ncol() == parts[0].ncol();
+        for (size_t j = 0; same && j < parts[i].ncol(); j++) {
+            same = parts[i].name(j) == parts[0].name(j);
+        }
+        if (!same) {
+            std::cerr << "Error: '" << paths[i] << "' doesn't have the columns of '" << paths[0] << "'\n";
+            return false;
+        }
+        n_rows += parts[i].nrow();
+    }
+    if (n_bytes != nullptr) {
+        *n_bytes = 0;
+        for (size_t b : bytes) {
+            *n_bytes += b;
+        }
+    }
+    // with a merge column, the file each row of the result is taken from (the
+    // files' rows are taken in order, so that's enough to gather the columns)
+    std::vector<uint32_t> order;
+    if (merge_column != "") {
+        int key = parts[0].find(merge_column);
+        if (key < 0) {
+            std::cerr << "Error: merge column '" << merge_column << "' not found in '" << paths[0] << "'\n";
+            return false;
+        }
+        auto key_of = [&](size_t f, size_t i) {
+            double v = parts[f].column(key)[i];
+            return std::isnan(v) ? std::numeric_limits<double>::infinity() : v; // (last)
+        };
+        using Head = std::pair<double, size_t>; // the key of a file's next row, and the file
+        std::priority_queue<Head, std::vector<Head>, std::greater<Head>> heads;
+        std::vector<size_t> next(parts.size(), 0);
+        for (size_t f = 0; f < parts.size(); f++) {
+            if (parts[f].nrow() > 0)
+                heads.push({key_of(f, 0), f});
+        }
+        order.reserve(n_rows);
+        while (!heads.empty()) {
+            size_t f = heads.top().second;
+            heads.pop();
+            order.push_back(static_cast<uint32_t>(f));
+            if (++next[f] < parts[f].nrow())
+                heads.push({key_of(f, next[f]), f});
+        }
+    }
+    df = DataFrame();
+    for (size_t j = 0; j < parts[0].ncol(); j++) {
+        df.add_column(parts[0].name(j));
+        for (const DataFrame& part : parts) {
+            if (part.is_text(j)) {
+                df.mark_text(j); // (in any of the files)
+                break;
+            }
+        }
+    }
+    auto gather_column = [&](size_t j) {
+        std::vector<double>& col = df.column(j);
+        col.resize(n_rows);
+        if (order.empty()) {
+            size_t at = 0;
+            for (DataFrame& part : parts) {
+                std::copy(part.column(j).begin(), part.column(j).end(), col.begin() + at);
+                at += part.column(j).size(); // (not nrow(), column 0 may be gathered already)
+            }
+        } else {
+            std::vector<size_t> next(parts.size(), 0);
+            for (size_t i = 0; i < n_rows; i++) {
+                col[i] = parts[order[i]].column(j)[next[order[i]]++];
+            }
+        }
+        for (DataFrame& part : parts) {
+            std::vector<double>().swap(part.column(j));
+        }
+    };
+    if (df.ncol() > 0) {
+        pool.parallel_for(df.ncol(), gather_column);
+    }
+    return true;
+}
+
+
+/* DataStore
+* The data files that are loaded in-process (--load), shared by every layer that
+* uses them: each file is mapped and parsed once, and then sent to gnuplot once
+* as a named datablock ($DATA, $DATA2, ...) that the layers' plot commands
+* reference instead of the file. Layers prepare their data in parallel (see
+* prepare_layers()), so a file is loaded by whichever layer needs it first while
+* the others wait for it; its name is given when it's first reserved, when the
+* layers are composed in order.
+*/
+struct Dataset {
+    std::string path;
+    std::string name; // datablock name, e.g. "$DATA"
+    DataFrame frame;
+    bool referenced = false; // only datasets a plot clause reads are sent
+    size_t n_bytes = 0;      // bytes of the file that were read (--watch follows the rest)
+    RowFilter filter;        // the rows of the file it holds (--xlim)
+    std::string merge;       // the column the files of a multi-file source are merged by
+    char delim = ' ';        // of the file's fields
+    bool loaded = false;
+    std::once_flag load_once;
+};
+
+// one pool for the whole process (sized by the first caller), so that plots
+// composed together in batch mode don't each start their own threads
+ThreadPool& shared_thread_pool(size_t n_threads = 0) {
+    static ThreadPool pool(n_threads);
+    return pool;
+}
+
+class DataStore {
+    private:
+        std::vector<std::unique_ptr<Dataset>> datasets;
+        std::mutex mutex; // guards datasets, not what they hold
+    public:
+        ThreadPool& thread_pool(size_t n_threads = 0) {
+            return shared_thread_pool(n_threads);
+        }
+        // get the dataset for path (its rows that pass the filter, merged by the
+        // merge column if it's a multi-file source), added (not loaded yet) if
+        // this is the first use
+        Dataset* reserve(const std::string& path, const RowFilter& filter = RowFilter(),
+                         const std::string& merge = "") {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (const auto& ds : datasets) {
+                if (ds->path == path && ds->filter == filter && ds->merge == merge) {
+                    return ds.get();
+                }
+            }
+            std::unique_ptr<Dataset> ds(new Dataset());
+            ds->path = path;
+            ds->filter = filter;
+            ds->merge = merge;
+            ds->name = datasets.empty() ? "$DATA" : "$DATA" + std::to_string(datasets.size() + 1);
+            datasets.push_back(std::move(ds));
+            return datasets.back().get();
+        }
+        // get the dataset for path (its rows that pass the filter), loading it
+        // if this is the first use - through the columnar cache in cache_dir,
+        // if given. Returns nullptr if it can't be loaded.
+        Dataset* load(const std::string& path, char delim, size_t n_threads = 0,
+                      const std::string& cache_dir = "", const RowFilter& filter = RowFilter(),
+                      const std::string& merge = "") {
+            Dataset* ds = reserve(path, filter, merge);
+            std::call_once(ds->load_once, [&]() {
+                StageTimer timer("load", path);
+                ds->delim = delim;
+                if (is_multi_source(path)) {
+                    ds->loaded = read_sources(path, delim, ds->frame, filter, merge, thread_pool(n_threads),
+                                              cache_dir, &ds->n_bytes);
+                } else {
+                    ds->loaded = (cache_dir != "")
+                        ? read_cached_table(path, cache_dir, delim, ds->frame, filter, &thread_pool(n_threads), &ds->n_bytes)
+                        : read_table(path, delim, ds->frame, &thread_pool(n_threads), &ds->n_bytes);
+                    if (ds->loaded && cache_dir == "") {
+                        filter_rows(ds->frame, filter);
+                    }
+                }
+                timer.bytes = ds->n_bytes;
+            });
+            return ds->loaded ? ds : nullptr;
+        }
+        // add a computed frame (e.g., a fitted curve), sent as a datablock
+        // named prefix + a number
+        Dataset* add(DataFrame frame, const std::string& prefix) {
+            std::lock_guard<std::mutex> lock(mutex);
+            std::unique_ptr<Dataset> ds(new Dataset());
+            ds->frame = std::move(frame);
+            size_t n_named = 1;
+            for (const auto& other : datasets) {
+                n_named += (other->name.compare(0, prefix.size(), prefix) == 0);
+            }
+            ds->name = prefix + std::to_string(n_named);
+            ds->referenced = true;
+            datasets.push_back(std::move(ds));
+            return datasets.back().get();
+        }
+        const std::vector<std::unique_ptr<Dataset>>& get_datasets() const { return datasets; }
+        // write the datablock definitions for every loaded file, with the
+        // separator gnuplot is set to use
+        void write_datablocks(PipeWriter& out, char delim) const {
+            for (const auto& ds : datasets) {
+                if (!ds->referenced)
+                    continue;
+                out.write(ds->name + " << EOD\n");
+                ds->frame.write_names(out, delim);
+                ds->frame.write_text(out, delim);
+                out.write("EOD\n");
+            }
+        }
+};
+
+
+// forward a column stream (a file, named FIFO, or "-" for stdin) to gnuplot as
+// inline data. Reads and writes fixed-size chunks, so memory use stays bounded
+// and gnuplot can start parsing before the whole input has been read.
+const size_t stream_chunk_size = 1 << 16;
+
+// gnuplot ends inline data at a line whose first non-blank character is 'e' (or
+// 'E'), and runs what follows as commands. Scans a chunk of a stream for such a
+// line, carrying the state of a line across chunks in at_start (whether only
+// blanks have been seen since the last newline). Returns the offset of the
+// newline before the line (or 0 if it started in an earlier chunk), or npos.
+size_t find_inline_end(const char* data, size_t n, bool& at_start) {
+    size_t line = 0;
+    for (size_t i = 0; i < n; i++) {
+        char c = data[i];
+        if (c == '\n') {
+            at_start = true;
+            line = i;
+        } else if (at_start && (c == 'e' || c == 'E')) {
+            return line;
+        } else if (c != ' ' && c != '\t') {
+            at_start = false;
+        }
+    }
+    return std::string::npos;
+}
+
+bool forward_stream(const std::string& src, PipeWriter& out) {
+    int fd = (src == "-") ? STDIN_FILENO : open(src.c_str(), O_RDONLY);
+    if (fd < 0) {
+        std::cerr << "Error: could not open stream '" << src << "': "
+                  << std::strerror(errno) << "\n";
+        out.write("e\n"); // still end the block so gnuplot doesn't wait on it
+        return false;
+    }
+    std::vector<char> chunk(stream_chunk_size);
+    char last = '\n';
+    bool at_start = true, ok = true;
+    ssize_t n;
+    while ((n = read(fd, chunk.data(), chunk.size())) != 0) {
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            std::cerr << "Error: reading stream '" << src << "': "
+                      << std::strerror(errno) << "\n";
+            break;
+        }
+        size_t end = find_inline_end(chunk.data(), n, at_start);
+        if (end != std::string::npos) {
+            // forward the rows before it, and stop there
+            std::cerr << "Error: stream '" << src << "' has a line starting with 'e', "
+                      << "which would end its inline data\n";
+            out.write(chunk.data(), end);
+            last = end > 0 ? chunk[end - 1] : last;
+            ok = false;
+            break;
+        }
+        out.write(chunk.data(), n);
+        out.flush();
+        last = chunk[n - 1];
+    }
+    if (last != '\n') {
+        out.put('\n');
+    }
+    out.write("e\n");
+    if (fd != STDIN_FILENO) {
+        close(fd);
+    }
+    return ok;
+}
+
+
+/* Downsampling
+* For plotting long series at about the resolution they're seen at. Both methods
+* work on the rows in order, so they suit series ordered by x (e.g. time).
+*/
+
+// Largest-Triangle-Three-Buckets: keep the first and last points, and from each
+// of n_out - 2 buckets in between, the point forming the largest triangle with
+// the last kept point and the mean of the next bucket
+void downsample_lttb(const std::vector<double>& x, const std::vector<double>& y, size_t n_out,
+                     std::vector<double>& out_x, std::vector<double>& out_y) {
+    size_t n = x.size();
+    out_x.clear();
+    out_y.clear();
+    if (n_out >= n || n_out < 3) {
+        out_x = x;
+        out_y = y;
+        return;
+    }
+    out_x.reserve(n_out);
+    out_y.reserve(n_out);
+    double bucket_size = static_cast<double>(n - 2) / (n_out - 2);
+    size_t kept = 0;
+    out_x.push_back(x[0]);
+    out_y.push_back(y[0]);
+    for (size_t b = 0; b < n_out - 2; b++) {
+        size_t start = static_cast<size_t>(b * bucket_size) + 1;
+        size_t end = static_cast<size_t>((b + 1) * bucket_size) + 1;
+        size_t next_end = std::min(static_cast<size_t>((b + 2) * bucket_size) + 1, n);
+        double avg_x = 0, avg_y = 0;
+        for (size_t i = end; i < next_end; i++) {
+            avg_x += x[i];
+            avg_y += y[i];
+        }
+        size_t n_next = next_end - end;
+        if (n_next > 0) {
+            avg_x /= n_next;
+            avg_y /= n_next;
+        } else {
+            avg_x = x[n - 1];
+            avg_y = y[n - 1];
+        }
+        double max_area = -1;
+        size_t chosen = start;
+        for (size_t i = start; i < end; i++) {
+            double area = std::fabs((x[kept] - avg_x) * (y[i] - y[kept]) -
+                                    (x[kept] - x[i]) * (avg_y - y[kept]));
+            if (area > max_area) {
+                max_area = area;
+                chosen = i;
+            }
+        }
+        out_x.push_back(x[chosen]);
+        out_y.push_back(y[chosen]);
+        kept = chosen;
+    }
+    out_x.push_back(x[n - 1]);
+    out_y.push_back(y[n - 1]);
+}
+
+// split the rows into n_out / 2 buckets and keep each bucket's min and max y
+// (in the order they occur), which preserves the series' envelope
+void downsample_minmax(const std::vector<double>& x, const std::vector<double>& y, size_t n_out,
+                       std::vector<double>& out_x, std::vector<double>& out_y) {
+    size_t n = x.size();
+    out_x.clear();
+    out_y.clear();
+    size_t n_buckets = n_out / 2;
+    if (n_out >= n || n_buckets == 0) {
+        out_x = x;
+        out_y = y;
+        return;
+    }
+    out_x.reserve(2 * n_buckets);
+    out_y.reserve(2 * n_buckets);
+    for (size_t b = 0; b < n_buckets; b++) {
+        size_t start = b * n / n_buckets, end = (b + 1) * n / n_buckets;
+        size_t lo = start, hi = start;
+        for (size_t i = start; i < end; i++) {
+            if (y[i] < y[lo]) lo = i;
+            if (y[i] > y[hi]) hi = i;
+        }
+        size_t first = std::min(lo, hi), second = std::max(lo, hi);
+        out_x.push_back(x[first]);
+        out_y.push_back(y[first]);
+        if (second != first) {
+            out_x.push_back(x[second]);
+            out_y.push_back(y[second]);
+        }
+    }
+}
+
+
+/* Stats
+* Layers that summarize their data (e.g., histograms) compute the summary
+* in-process, so only the result is sent to gnuplot. The passes over the rows
+* are split into chunks counted by the shared thread pool, each into its own
+* partial result, which are merged at the end.
+*/
+const size_t stat_chunk_rows = 1 << 16;
+
+// the number of tasks to split n rows into
+size_t stat_tasks(size_t n, ThreadPool& pool) {
+    return std::max<size_t>(1, std::min(pool.size() + 1, n / stat_chunk_rows));
+}
+
+// the smallest and largest of the values (NaN if there are none)
+void column_range(const std::vector<double>& x, ThreadPool& pool, double& lo, double& hi) {
+    size_t n = x.size(), n_tasks = stat_tasks(n, pool);
+    std::vector<double> los(n_tasks, std::numeric_limits<double>::infinity());
+    std::vector<double> his(n_tasks, -std::numeric_limits<double>::infinity());
+    pool.parallel_for(n_tasks, [&](size_t t) {
+        double task_lo = los[t], task_hi = his[t];
+        for (size_t i = t * n / n_tasks, end = (t + 1) * n / n_tasks; i < end; i++) {
+            task_lo = std::min(task_lo, x[i]);
+            task_hi = std::max(task_hi, x[i]);
+        }
+        los[t] = task_lo;
+        his[t] = task_hi;
+    });
+    lo = *std::min_element(los.begin(), los.end());
+    hi = *std::max_element(his.begin(), his.end());
+    if (n == 0) {
+        lo = hi = std::numeric_limits<double>::quiet_NaN();
+    }
+}
+
+// equal-width bins covering a range of values
+struct Bins {
+    double lo = 0;
+    double width = 1;
+    size_t n = 1;
+    // the bin holding v (values outside are put in the first or last bin)
+    size_t index(double v) const {
+        double b = std::floor((v - lo) / width);
+        return static_cast<size_t>(std::clamp(b, 0.0, static_cast<double>(n - 1)));
+    }
+    double center(size_t b) const { return lo + (b + 0.5) * width; }
+};
+
+// the most bins of a histogram (or cells of a 2d grid); each task counts into
+// its own copy of the bins
+const size_t max_bins = 1 << 20;
+
+// bins covering the values of x: n_bins of them, or bins of the given width
+// (if not 0) centered on multiples of it. False (with an error) if the width
+// isn't a positive number, or there would be more than max_bins bins.
+bool make_bins(const std::vector<double>& x, ThreadPool& pool, size_t n_bins, double width, Bins& bins) {
+    bins = Bins();
+    double lo, hi;
+    column_range(x, pool, lo, hi);
+    if (x.empty()) {
+        lo = hi = 0;
+    }
+    if (width < 0 || !std::isfinite(width)) {
+        std::cerr << "Error: bin width must be a positive number\n";
+        return false;
+    }
+    if (n_bins > max_bins) {
+        std::cerr << "Error: at most " << max_bins << " bins, got " << n_bins << "\n";
+        return false;
+    }
+    if (width > 0) {
+        bins.width = width;
+        bins.lo = (std::floor(lo / width + 0.5) - 0.5) * width;
+        double n = std::floor((hi - bins.lo) / width) + 1;
+        if (!(n <= max_bins)) { // (also if it's NaN, e.g. for infinite values)
+            std::cerr << "Error: bin width " << width << " makes more than " << max_bins << " bins\n";
+            return false;
+        }
+        bins.n = static_cast<size_t>(n);
+    } else if (hi > lo) {
+        bins.n = std::max<size_t>(1, n_bins);
+        bins.width = (hi - lo) / bins.n;
+        bins.lo = lo;
+    } else {
+        // all values are the same, center a single bin on them
+        bins.lo = lo - 0.5;
+    }
+    return true;
+}
+
+// count the values of x in each bin
+std::vector<double> histogram_counts(const std::vector<double>& x, const Bins& bins,
+                                     ThreadPool& pool) {
+    size_t n = x.size(), n_tasks = stat_tasks(n, pool);
+    std::vector<std::vector<size_t>> partial(n_tasks);
+    pool.parallel_for(n_tasks, [&](size_t t) {
+        std::vector<size_t> counts(bins.n, 0);
+        for (size_t i = t * n / n_tasks, end = (t + 1) * n / n_tasks; i < end; i++) {
+            counts[bins.index(x[i])]++;
+        }
+        partial[t] = std::move(counts);
+    });
+    std::vector<double> counts(bins.n, 0);
+    for (const auto& task_counts : partial) {
+        for (size_t b = 0; b < bins.n; b++) {
+            counts[b] += task_counts[b];
+        }
+    }
+    return counts;
+}
+
+// count the points (x, y) in each cell of the grid of x_bins by y_bins. The
+// counts are stored by row (cell (i, j) at j * x_bins.n + i), and each task
+// counts into its own grid of 32 bit counts, to keep the grids small.
+std::vector<double> bin2d_counts(const std::vector<double>& x, const std::vector<double>& y,
+                                 const Bins& x_bins, const Bins& y_bins, ThreadPool& pool) {
+    size_t n = x.size(), n_tasks = stat_tasks(n, pool);
+    size_t n_cells = x_bins.n * y_bins.n;
+    std::vector<std::vector<uint32_t>> partial(n_tasks);
+    pool.parallel_for(n_tasks, [&](size_t t) {
+        std::vector<uint32_t> counts(n_cells, 0);
+        for (size_t i = t * n / n_tasks, end = (t + 1) * n / n_tasks; i < end; i++) {
+            counts[y_bins.index(y[i]) * x_bins.n + x_bins.index(x[i])]++;
+        }
+        partial[t] = std::move(counts);
+    });
+    std::vector<double> counts(n_cells, 0);
+    for (const auto& task_counts : partial) {
+        for (size_t c = 0; c < n_cells; c++) {
+            counts[c] += task_counts[c];
+        }
+    }
+    return counts;
+}
+
+// running moments of (x, y) pairs - means and sums of squared deviations -
+// updated in a single pass, and merged across tasks
+struct Moments {
+    double n = 0;
+    double mx = 0, my = 0;
+    double cxx = 0, cxy = 0, cyy = 0;
+    double x_lo = std::numeric_limits<double>::infinity();
+    double x_hi = -std::numeric_limits<double>::infinity();
+    void add(double x, double y) {
+        n++;
+        double dx = x - mx, dy = y - my;
+        mx += dx / n;
+        my += dy / n;
+        cxx += dx * (x - mx);
+        cxy += dx * (y - my);
+        cyy += dy * (y - my);
+        x_lo = std::min(x_lo, x);
+        x_hi = std::max(x_hi, x);
+    }
+    void merge(const Moments& o) {
+        if (o.n == 0)
+            return;
+        if (n == 0) {
+            *this = o;
+            return;
+        }
+        double total = n + o.n, dx = o.mx - mx, dy = o.my - my, f = n * o.n / total;
+        cxx += o.cxx + dx * dx * f;
+        cxy += o.cxy + dx * dy * f;
+        cyy += o.cyy + dy * dy * f;
+        mx += dx * o.n / total;
+        my += dy * o.n / total;
+        n = total;
+        x_lo = std::min(x_lo, o.x_lo);
+        x_hi = std::max(x_hi, o.x_hi);
+    }
+};
+
+// a fitted curve, with the standard error of the fit at each point
+struct Curve {
+    std::vector<double> x, y, se;
+};
+
+// least squares line through the points, from a single pass over them,
+// evaluated at n_out points across the range of x
+void smooth_lm(const std::vector<double>& x, const std::vector<double>& y, size_t n_out,
+               ThreadPool& pool, Curve& curve) {
+    size_t n = x.size(), n_tasks = stat_tasks(n, pool);
+    std::vector<Moments> partial(n_tasks);
+    pool.parallel_for(n_tasks, [&](size_t t) {
+        Moments m;
+        for (size_t i = t * n / n_tasks, end = (t + 1) * n / n_tasks; i < end; i++) {
+            m.add(x[i], y[i]);
+        }
+        partial[t] = m;
+    });
+    Moments m;
+    for (const auto& task_moments : partial) {
+        m.merge(task_moments);
+    }
+    curve = Curve();
+    if (m.n < 2 || m.cxx <= 0) {
+        return;
+    }
+    double slope = m.cxy / m.cxx;
+    double s2 = (m.n > 2) ? std::max(0.0, m.cyy - slope * m.cxy) / (m.n - 2) : 0;
+    for (size_t g = 0; g < n_out; g++) {
+        double x0 = m.x_lo + (m.x_hi - m.x_lo) * g / (n_out - 1);
+        curve.x.push_back(x0);
+        curve.y.push_back(m.my + slope * (x0 - m.mx));
+        curve.se.push_back(std::sqrt(s2 * (1 / m.n + (x0 - m.mx) * (x0 - m.mx) / m.cxx)));
+    }
+}
+
+// the mean of y in each bin of x (at the mean x of the bin), from a single
+// pass over the points once the bins are known. Empty bins are left out.
+void smooth_bins(const std::vector<double>& x, const std::vector<double>& y, const Bins& bins,
+                 ThreadPool& pool, Curve& curve) {
+    size_t n = x.size(), n_tasks = stat_tasks(n, pool);
+    std::vector<std::vector<Moments>> partial(n_tasks);
+    pool.parallel_for(n_tasks, [&](size_t t) {
+        std::vector<Moments> moments(bins.n);
+        for (size_t i = t * n / n_tasks, end = (t + 1) * n / n_tasks; i < end; i++) {
+            moments[bins.index(x[i])].add(x[i], y[i]);
+        }
+        partial[t] = std::move(moments);
+    });
+    curve = Curve();
+    for (size_t b = 0; b < bins.n; b++) {
+        Moments m;
+        for (const auto& task_moments : partial) {
+            m.merge(task_moments[b]);
+        }
+        if (m.n == 0)
+            continue;
+        curve.x.push_back(m.mx);
+        curve.y.push_back(m.my);
+        curve.se.push_back((m.n > 1) ? std::sqrt(m.cyy / (m.n - 1) / m.n) : 0);
+    }
+}
+
+// local quadratic regression (LOESS, with tricube weights on the nearest span * n
+// points), evaluated at n_out points across the range of x. The standard error
+// uses the residuals around the curve, so it's approximate.
+void smooth_loess(const std::vector<double>& x, const std::vector<double>& y, size_t n_out,
+                  double span, Curve& curve) {
+    size_t n = x.size();
+    curve = Curve();
+    if (n < 2) {
+        return;
+    }
+    std::vector<size_t> order(n);
+    for (size_t i = 0; i < n; i++) {
+        order[i] = i;
+    }
+    std::sort(order.begin(), order.end(), [&x](size_t a, size_t b) { return x[a] < x[b]; });
+    std::vector<double> xs(n), ys(n), w;
+    for (size_t i = 0; i < n; i++) {
+        xs[i] = x[order[i]];
+        ys[i] = y[order[i]];
+    }
+    size_t k = std::clamp<size_t>(static_cast<size_t>(std::ceil(span * n)), 2, n);
+    std::vector<double> norms; // sqrt of the sum of squared smoother weights
+    for (size_t g = 0; g < n_out; g++) {
+        double x0 = xs[0] + (xs[n - 1] - xs[0]) * g / (n_out - 1);
+        // the window of the k points nearest x0
+        size_t l = std::lower_bound(xs.begin(), xs.end(), x0) - xs.begin(), r = l;
+        while (r - l < k) {
+            if (l == 0 || (r < n && xs[r] - x0 < x0 - xs[l - 1])) {
+                r++;
+            } else {
+                l--;
+            }
+        }
+        double d_max = std::max(x0 - xs[l], xs[r - 1] - x0) * 1.0001;
+        if (d_max <= 0) {
+            d_max = 1;
+        }
+        // weighted quadratic in u = x - x0, whose value at x0 is the fit. It's
+        // a linear smoother: the fit is sum(l_i * y_i), with l_i from the first
+        // row of the inverse of X'WX.
+        w.assign(r - l, 0);
+        double m[5] = {0, 0, 0, 0, 0}; // sum(w * u^p)
+        for (size_t i = l; i < r; i++) {
+            double u = xs[i] - x0;
+            double t = 1 - std::pow(std::fabs(u) / d_max, 3);
+            w[i - l] = t * t * t;
+            double wu = w[i - l];
+            for (int p = 0; p < 5; p++) {
+                m[p] += wu;
+                wu *= u;
+            }
+        }
+        double c0 = m[2] * m[4] - m[3] * m[3];
+        double c1 = m[2] * m[3] - m[1] * m[4];
+        double c2 = m[1] * m[3] - m[2] * m[2];
+        double det = m[0] * c0 + m[1] * c1 + m[2] * c2;
+        if (std::fabs(det) <= 1e-12 * std::fabs(m[0] * c0)) {
+            // too few distinct x in the window, use the weighted mean
+            c0 = 1;
+            c1 = c2 = 0;
+            det = m[0];
+        }
+        double fit = 0, norm = 0;
+        for (size_t i = l; i < r; i++) {
+            double u = xs[i] - x0;
+            double li = w[i - l] * (c0 + c1 * u + c2 * u * u) / det;
+            fit += li * ys[i];
+            norm += li * li;
+        }
+        curve.x.push_back(x0);
+        curve.y.push_back(fit);
+        norms.push_back(std::sqrt(norm));
+    }
+    // residual variance around the curve (interpolated at each point)
+    double rss = 0;
+    size_t g = 0;
+    for (size_t i = 0; i < n; i++) {
+        while (g + 2 < n_out && curve.x[g + 1] < xs[i])
+            g++;
+        double dx = curve.x[g + 1] - curve.x[g];
+        double f = (dx > 0) ? (xs[i] - curve.x[g]) / dx : 0;
+        double fit = curve.y[g] + f * (curve.y[g + 1] - curve.y[g]);
+        rss += (ys[i] - fit) * (ys[i] - fit);
+    }
+    double sigma = std::sqrt(rss / std::max<double>(1, n - 2));
+    for (double norm : norms) {
+        curve.se.push_back(sigma * norm);
+    }
+}
+
+/* Column expressions
+* Using specs such as "(column('y') - column('z'))" or "(log($1))" are compiled
+* once into a small postfix program, which is run over the columns of loaded
+* data in batches of expr_batch rows. Each instruction loops over a whole batch,
+* so the loops are simple enough for the compiler to vectorize, and batches are
+* split over the thread pool.
+* Supported: numbers, pi, NaN, $n and column(n), column('name'), $0 (the row
+* index), + - * / % **, comparisons, ! && ||, ?: and the functions below.
+* As in gnuplot, a division by zero is undefined (NaN), as is a row with a
+* missing value, and integer constants use integer arithmetic (1/2 is 0).
+*/
+const size_t expr_batch = 256;
+
+class Expression {
+    private:
+        enum class Op : uint8_t {
+            constant, column, row,
+            neg, not_, add, sub, mul, div, mod, pow,
+            lt, le, gt, ge, eq, ne, and_, or_, select,
+            abs, sqrt, exp, log, log10, sin, cos, tan, asin, acos, atan,
+            sinh, cosh, tanh, floor, ceil, int_, sgn, atan2,
+        };
+        struct Instr {
+            Op op;
+            double value = 0;     // of a constant
+            size_t arg = 0;       // column of a column (an index into refs)
+            bool integer = false; // a constant holding an integer
+        };
+        struct Function {
+            const char* name;
+            Op op;
+            size_t n_args;
+        };
+        static constexpr Function functions[] = {
+            {"abs", Op::abs, 1}, {"sqrt", Op::sqrt, 1}, {"exp", Op::exp, 1},
+            {"log", Op::log, 1}, {"log10", Op::log10, 1}, {"sin", Op::sin, 1},
+            {"cos", Op::cos, 1}, {"tan", Op::tan, 1}, {"asin", Op::asin, 1},
+            {"acos", Op::acos, 1}, {"atan", Op::atan, 1}, {"sinh", Op::sinh, 1},
+            {"cosh", Op::cosh, 1}, {"tanh", Op::tanh, 1}, {"floor", Op::floor, 1},
+            {"ceil", Op::ceil, 1}, {"int", Op::int_, 1}, {"sgn", Op::sgn, 1},
+            {"atan2", Op::atan2, 2},
+        };
+        std::vector<Instr> code;
+        std::vector<std::string> refs; // the columns read, by name or 1-based number
+        size_t depth = 0;              // of the stack, while running
+        // (parser state)
+        std::string_view text;
+        size_t pos = 0;
+        std::string error;
+
+        static size_t _n_operands(Op op) {
+            switch (op) {
+                case Op::constant: case Op::column: case Op::row:
+                    return 0;
+                case Op::select:
+                    return 3;
+                case Op::neg: case Op::not_:
+                    return 1;
+                default:
+                    break;
+            }
+            for (const Function& f : functions) {
+                if (f.op == op)
+                    return f.n_args;
+            }
+            return 2;
+        }
+        static double _apply(Op op, double a, double b = 0, double c = 0) {
+            const double nan = std::numeric_limits<double>::quiet_NaN();
+            switch (op) {
+                case Op::neg:   return -a;
+                case Op::not_:  return a == 0;
+                case Op::add:   return a + b;
+                case Op::sub:   return a - b;
+                case Op::mul:   return a * b;
+                case Op::div:   return (b == 0) ? nan : a / b;
+                case Op::mod:   return (b == 0) ? nan : std::fmod(a, b);
+                case Op::pow:   return std::pow(a, b);
+                case Op::lt:    return a < b;
+                case Op::le:    return a <= b;
+                case Op::gt:    return a > b;
+                case Op::ge:    return a >= b;
+                case Op::eq:    return a == b;
+                case Op::ne:    return a != b;
+                case Op::and_:  return a != 0 && b != 0;
+                case Op::or_:   return a != 0 || b != 0;
+                case Op::select: return std::isnan(a) ? nan : (a != 0 ? b : c);
+                case Op::abs:   return std::fabs(a);
+                case Op::sqrt:  return std::sqrt(a);
+                case Op::exp:   return std::exp(a);
+                case Op::log:   return std::log(a);
+                case Op::log10: return std::log10(a);
+                case Op::sin:   return std::sin(a);
+                case Op::cos:   return std::cos(a);
+                case Op::tan:   return std::tan(a);
+                case Op::asin:  return std::asin(a);
+                case Op::acos:  return std::acos(a);
+                case Op::atan:  return std::atan(a);
+                case Op::sinh:  return std::sinh(a);
+                case Op::cosh:  return std::cosh(a);
+                case Op::tanh:  return std::tanh(a);
+                case Op::floor: return std::floor(a);
+                case Op::ceil:  return std::ceil(a);
+                case Op::int_:  return std::trunc(a);
+                case Op::sgn:   return (a > 0) - (a < 0);
+                case Op::atan2: return std::atan2(a, b);
+                default:        return nan;
+            }
+        }
+
+        // emit an operator, folding it into a constant if its operands are
+        void _emit(Op op) {
+            size_t n = _n_operands(op);
+            bool constant = code.size() >= n;
+            bool integer = true;
+            for (size_t i = code.size() - std::min(n, code.size()); i < code.size(); i++) {
+                constant = constant && code[i].op == Op::constant;
+                integer = integer && code[i].integer;
+            }
+            if (!constant) {
+                code.push_back(Instr{op});
+                return;
+            }
+            double args[3] = {0, 0, 0};
+            for (size_t i = 0; i < n; i++) {
+                args[i] = code[code.size() - n + i].value;
+            }
+            code.resize(code.size() - n);
+            Instr folded{Op::constant};
+            if (integer && (op == Op::div || op == Op::mod) && args[1] != 0) {
+                long long a = static_cast<long long>(args[0]), b = static_cast<long long>(args[1]);
+                folded.value = static_cast<double>(op == Op::div ? a / b : a % b);
+                folded.integer = true;
+            } else {
+                folded.value = _apply(op, args[0], args[1], args[2]);
+                folded.integer = integer && (op == Op::neg || op == Op::add || op == Op::sub ||
+                                             op == Op::mul || (op == Op::pow && args[1] >= 0));
+            }
+            code.push_back(folded);
+        }
+
+        void _skip_space() {
+            while (pos < text.size() && std::isspace(static_cast<unsigned char>(text[pos])))
+                pos++;
+        }
+        bool _accept(std::string_view token) {
+            _skip_space();
+            if (text.substr(pos, token.size()) != token)
+                return false;
+            pos += token.size();
+            return true;
+        }
+        bool _expect(std::string_view token) {
+            if (_accept(token))
+                return true;
+            _fail("expected '" + std::string(token) + "'");
+            return false;
+        }
+        bool _fail(const std::string& message) {
+            if (error.empty()) {
+                error = message + " at position " + std::to_string(pos + 1);
+            }
+            return false;
+        }
+        void _push_column(const std::string& ref) {
+            size_t ix = std::find(refs.begin(), refs.end(), ref) - refs.begin();
+            if (ix == refs.size()) {
+                refs.push_back(ref);
+            }
+            Instr instr{Op::column};
+            instr.arg = ix;
+            code.push_back(instr);
+        }
+
+        // expression := or ['?' expression ':' expression]
+        bool _expression() {
+            if (!_binary(0))
+                return false;
+            if (_accept("?")) {
+                if (!_expression() || !_expect(":") || !_expression())
+                    return false;
+                _emit(Op::select);
+            }
+            return true;
+        }
+        // binary operators by precedence level, lowest first
+        bool _binary(size_t level) {
+            struct BinaryOp {
+                const char* token;
+                Op op;
+            };
+            static const std::vector<std::vector<BinaryOp>> levels = {
+                {{"||", Op::or_}},
+                {{"&&", Op::and_}},
+                {{"==", Op::eq}, {"!=", Op::ne}},
+                {{"<=", Op::le}, {">=", Op::ge}, {"<", Op::lt}, {">", Op::gt}},
+                {{"+", Op::add}, {"-", Op::sub}},
+                {{"*", Op::mul}, {"/", Op::div}, {"%", Op::mod}},
+            };
+            if (level == levels.size()) {
+                return _unary();
+            }
+            if (!_binary(level + 1))
+                return false;
+            while (true) {
+                const BinaryOp* found = nullptr;
+                for (const BinaryOp& b : levels[level]) {
+                    if (b.op == Op::mul && _peek("**"))
+                        continue; // (handled by _power())
+                    if (_accept(b.token)) {
+                        found = &b;
+                        break;
+                    }
+                }
+                if (found == nullptr)
+                    return true;
+                if (!_binary(level + 1))
+                    return false;
+                _emit(found->op);
+            }
+        }
+        bool _peek(std::string_view token) {
+            _skip_space();
+            return text.substr(pos, token.size()) == token;
+        }
+        // unary := ('-' | '+' | '!') unary | power
+        bool _unary() {
+            if (_accept("-")) {
+                if (!_unary())
+                    return false;
+                _emit(Op::neg);
+                return true;
+            }
+            if (_accept("+")) {
+                return _unary();
+            }
+            if (_accept("!")) {
+                if (!_unary())
+                    return false;
+                _emit(Op::not_);
+                return true;
+            }
+            return _power();
+        }
+        // power := primary ['**' unary]   (right associative, above unary minus)
+        bool _power() {
+            if (!_primary())
+                return false;
+            if (_accept("**")) {
+                if (!_unary())
+                    return false;
+                _emit(Op::pow);
+            }
+            return true;
+        }
+        // primary := number | $n | name | name '(' args ')' | '(' expression ')'
+        bool _primary() {
+            _skip_space();
+            if (pos >= text.size()) {
+                return _fail("unexpected end");
+            }
+            char c = text[pos];
+            if (c == '(') {
+                pos++;
+                return _expression() && _expect(")");
+            }
+            if (std::isdigit(static_cast<unsigned char>(c)) || c == '.') {
+                return _number();
+            }
+            if (c == '$') {
+                size_t start = ++pos;
+                while (pos < text.size() && std::isdigit(static_cast<unsigned char>(text[pos])))
+                    pos++;
+                if (pos == start) {
+                    return _fail("expected a column number after '$'");
+                }
+                size_t column = 0;
+                if (std::from_chars(text.data() + start, text.data() + pos, column).ec != std::errc()) {
+                    return _fail("column number '$" + std::string(text.substr(start, pos - start)) + "' is too large");
+                }
+                if (column == 0) {
+                    code.push_back(Instr{Op::row});
+                } else {
+                    _push_column(std::to_string(column));
+                }
+                return true;
+            }
+            if (std::isalpha(static_cast<unsigned char>(c)) || c == '_') {
+                size_t start = pos;
+                while (pos < text.size() && (std::isalnum(static_cast<unsigned char>(text[pos])) || text[pos] == '_'))
+                    pos++;
+                return _name(text.substr(start, pos - start));
+            }
+            return _fail("unexpected '" + std::string(1, c) + "'");
+        }
+        bool _number() {
+            size_t start = pos;
+            bool integer = true;
+            while (pos < text.size() && std::isdigit(static_cast<unsigned char>(text[pos])))
+                pos++;
+            if (pos < text.size() && text[pos] == '.') {
+                integer = false;
+                pos++;
+                while (pos < text.size() && std::isdigit(static_cast<unsigned char>(text[pos])))
+                    pos++;
+            }
+            if (pos < text.size() && (text[pos] == 'e' || text[pos] == 'E')) {
+                size_t exp = pos + 1;
+                if (exp < text.size() && (text[exp] == '+' || text[exp] == '-'))
+                    exp++;
+                if (exp < text.size() && std::isdigit(static_cast<unsigned char>(text[exp]))) {
+                    integer = false;
+                    pos = exp;
+                    while (pos < text.size() && std::isdigit(static_cast<unsigned char>(text[pos])))
+                        pos++;
+                }
+            }
+            Instr instr{Op::constant};
+            instr.integer = integer;
+            if (!parse_double(text.substr(start, pos - start), instr.value)) {
+                pos = start;
+                return _fail("bad number");
+            }
+            code.push_back(instr);
+            return true;
+        }
+        bool _name(std::string_view name) {
+            if (name == "pi") {
+                code.push_back(Instr{Op::constant, 3.14159265358979323846});
+                return true;
+            }
+            if (name == "NaN") {
+                code.push_back(Instr{Op::constant, std::numeric_limits<double>::quiet_NaN()});
+                return true;
+            }
+            if (!_expect("(")) {
+                return false;
+            }
+            if (name == "column") {
+                // column('name') or column(n), with a constant argument
+                _skip_space();
+                char quote = (pos < text.size()) ? text[pos] : '\0';
+                if (quote == '\'' || quote == '"') {
+                    size_t end = text.find(quote, pos + 1);
+                    if (end == std::string_view::npos) {
+                        return _fail("unterminated string");
+                    }
+                    _push_column(std::string(text.substr(pos + 1, end - pos - 1)));
+                    pos = end + 1;
+                } else {
+                    size_t start = code.size();
+                    if (!_expression())
+                        return false;
+                    if (code.size() != start + 1 || code.back().op != Op::constant || !code.back().integer) {
+                        return _fail("column() needs a name or a constant number");
+                    }
+                    double n = code.back().value;
+                    code.pop_back();
+                    if (n == 0) {
+                        code.push_back(Instr{Op::row});
+                    } else if (n > 0) {
+                        _push_column(std::to_string(static_cast<size_t>(n)));
+                    } else {
+                        return _fail("bad column number");
+                    }
+                }
+                return _expect(")");
+            }
+            for (const Function& f : functions) {
+                if (name != f.name)
+                    continue;
+                for (size_t i = 0; i < f.n_args; i++) {
+                    if ((i > 0 && !_expect(",")) || !_expression())
+                        return false;
+                }
+                if (!_expect(")"))
+                    return false;
+                _emit(f.op);
+                return true;
+            }
+            pos -= name.size() + 1;
+            return _fail("unknown function '" + std::string(name) + "'");
+        }
+
+        // the loop of one instruction over a batch, by number of operands
+        template <typename Fn>
+        static void _run(size_t n, double* out, const double* a, Fn fn) {
+            for (size_t i = 0; i < n; i++) {
+                out[i] = fn(a[i]);
+            }
+        }
+        template <typename Fn>
+        static void _run(size_t n, double* out, const double* a, const double* b, Fn fn) {
+            for (size_t i = 0; i < n; i++) {
+                out[i] = fn(a[i], b[i]);
+            }
+        }
+        template <typename Fn>
+        static void _run(size_t n, double* out, const double* a, const double* b, const double* c, Fn fn) {
+            for (size_t i = 0; i < n; i++) {
+                out[i] = fn(a[i], b[i], c[i]);
+            }
+        }
+        // evaluate rows [start, start + n) into out, with a stack of depth
+        // batches; an operand either points into a column or into the stack
+        void _evaluate(const std::vector<const double*>& cols, size_t start, size_t n,
+                       std::vector<double>& stack, std::vector<const double*>& top, double* out) const {
+            size_t sp = 0;
+            for (const Instr& instr : code) {
+                double* slot = nullptr;
+                switch (instr.op) {
+                    case Op::constant:
+                        slot = &stack[sp * expr_batch];
+                        std::fill(slot, slot + n, instr.value);
+                        top[sp++] = slot;
+                        continue;
+                    case Op::column:
+                        top[sp++] = cols[instr.arg] + start;
+                        continue;
+                    case Op::row:
+                        slot = &stack[sp * expr_batch];
+                        for (size_t i = 0; i < n; i++) {
+                            slot[i] = static_cast<double>(start + i);
+                        }
+                        top[sp++] = slot;
+                        continue;
+                    default:
+                        break;
+                }
+                size_t n_args = _n_operands(instr.op);
+                sp -= n_args;
+                slot = &stack[sp * expr_batch];
+                const double* a = top[sp];
+                const double* b = (n_args > 1) ? top[sp + 1] : nullptr;
+                const double* c = (n_args > 2) ? top[sp + 2] : nullptr;
+                Op op = instr.op;
+                // common operators get their own loops, the rest go through _apply()
+                switch (op) {
+                    case Op::add:
+                        _run(n, slot, a, b, [](double x, double y) { return x + y; });
+                        break;
+                    case Op::sub:
+                        _run(n, slot, a, b, [](double x, double y) { return x - y; });
+                        break;
+                    case Op::mul:
+                        _run(n, slot, a, b, [](double x, double y) { return x * y; });
+                        break;
+                    case Op::div:
+                        _run(n, slot, a, b, [](double x, double y) {
+                            return (y == 0) ? std::numeric_limits<double>::quiet_NaN() : x / y;
+                        });
+                        break;
+                    case Op::neg:
+                        _run(n, slot, a, [](double x) { return -x; });
+                        break;
+                    case Op::sqrt:
+                        _run(n, slot, a, [](double x) { return std::sqrt(x); });
+                        break;
+                    case Op::abs:
+                        _run(n, slot, a, [](double x) { return std::fabs(x); });
+                        break;
+                    default:
+                        if (n_args == 1) {
+                            _run(n, slot, a, [op](double x) { return _apply(op, x); });
+                        } else if (n_args == 2) {
+                            _run(n, slot, a, b, [op](double x, double y) { return _apply(op, x, y); });
+                        } else {
+                            _run(n, slot, a, b, c, [op](double x, double y, double z) { return _apply(op, x, y, z); });
+                        }
+                        break;
+                }
+                top[sp++] = slot;
+            }
+            std::copy(top[0], top[0] + n, out);
+        }
+
+    public:
+        // compile a using spec, e.g. "(column('y') - $3)"; false (see error())
+        // if it isn't supported
+        bool compile(std::string_view _text) {
+            text = _text;
+            pos = 0;
+            code.clear();
+            refs.clear();
+            error.clear();
+            if (!_expression())
+                return false;
+            _skip_space();
+            if (pos != text.size()) {
+                return _fail("unexpected '" + std::string(text.substr(pos, 1)) + "'");
+            }
+            // the stack depth the program needs
+            size_t sp = 0;
+            depth = 0;
+            for (const Instr& instr : code) {
+                sp = sp - _n_operands(instr.op) + 1;
+                depth = std::max(depth, sp);
+            }
+            return true;
+        }
+        const std::string& get_error() const { return error; }
+        // the columns the expression reads, by name or 1-based number, in the
+        // order evaluate() takes them
+        const std::vector<std::string>& columns() const { return refs; }
+        // the expression's value for each of the n rows of cols
+        std::vector<double> evaluate(const std::vector<const double*>& cols, size_t n, ThreadPool& pool) const {
+            std::vector<double> out(n);
+            size_t n_batches = (n + expr_batch - 1) / expr_batch;
+            size_t n_tasks = std::min(n_batches, stat_tasks(n, pool));
+            pool.parallel_for(n_tasks, [&](size_t t) {
+                std::vector<double> stack(depth * expr_batch);
+                std::vector<const double*> top(depth);
+                for (size_t b = t * n_batches / n_tasks, end = (t + 1) * n_batches / n_tasks; b < end; b++) {
+                    size_t start = b * expr_batch;
+                    _evaluate(cols, start, std::min(expr_batch, n - start), stack, top, &out[start]);
+                }
+            });
+            return out;
+        }
+};
+
+// a using spec that is an expression rather than a column, e.g. "(log($1))"
+bool is_expression(std::string_view var) {
+    return !var.empty() && var[0] == '(';
+}
+
+
+/* Scales
+* Variable aesthetics, given as a column expression (--size "($3)", --color
+* "(column('z'))"), are mapped to point sizes and colors in-process. gnuplot
+* gets them as plain columns ("pointsize variable", "linecolor rgb variable"),
+* so it doesn't look up a palette for each point. Sizes are scaled by area,
+* as in ggplot's scale_size(), and colors are quantized to a fixed colormap
+* of colormap_size steps of ggplot's default continuous scale.
+*/
+const double size_range[2] = {0.5, 3.0}; // pointsizes of the smallest and largest values
+const size_t colormap_size = 64;
+
+// the colormap, as 0xRRGGBB values from #132b43 to #56b1f7
+const std::array<uint32_t, colormap_size>& colormap() {
+    static const std::array<uint32_t, colormap_size> map = [] {
+        const uint32_t low = 0x132b43, high = 0x56b1f7;
+        std::array<uint32_t, colormap_size> m;
+        for (size_t i = 0; i < colormap_size; i++) {
+            double t = static_cast<double>(i) / (colormap_size - 1);
+            uint32_t rgb = 0;
+            for (int shift = 16; shift >= 0; shift -= 8) {
+                double a = (low >> shift) & 0xff, b = (high >> shift) & 0xff;
+                rgb |= static_cast<uint32_t>(std::lround(a + t * (b - a))) << shift;
+            }
+            m[i] = rgb;
+        }
+        return m;
+    }();
+    return map;
+}
+
+// where each value falls in the range of the values, from 0 to 1 (0.5 if
+// they're all the same)
+template <typename Fn>
+std::vector<double> scale_values(const std::vector<double>& v, ThreadPool& pool, Fn fn) {
+    double lo, hi;
+    column_range(v, pool, lo, hi);
+    double span = hi - lo;
+    std::vector<double> out(v.size());
+    size_t n = v.size(), n_tasks = stat_tasks(n, pool);
+    pool.parallel_for(n_tasks, [&](size_t t) {
+        for (size_t i = t * n / n_tasks, end = (t + 1) * n / n_tasks; i < end; i++) {
+            out[i] = fn((span > 0) ? (v[i] - lo) / span : 0.5);
+        }
+    });
+    return out;
+}
+
+// pointsizes for the values, with the area proportional to the value
+std::vector<double> scale_sizes(const std::vector<double>& v, ThreadPool& pool) {
+    const double lo = size_range[0] * size_range[0], hi = size_range[1] * size_range[1];
+    return scale_values(v, pool, [lo, hi](double t) { return std::sqrt(lo + t * (hi - lo)); });
+}
+
+// colormap colors for the values (0xRRGGBB, for "linecolor rgb variable")
+std::vector<double> scale_colors(const std::vector<double>& v, ThreadPool& pool) {
+    const std::array<uint32_t, colormap_size>& map = colormap();
+    return scale_values(v, pool, [&map](double t) {
+        size_t ix = std::min(colormap_size - 1, static_cast<size_t>(t * colormap_size));
+        return static_cast<double>(map[ix]);
+    });
+}
+
+
+/* Live data
+* For --live layers, samples (one per line) are read from a stream by a reader
+* thread, and handed to the render loop through a lock-free single-producer,
+* single-consumer queue. The render loop keeps the last samples of each series
+* in a fixed-size ring buffer, so memory use doesn't grow however long it runs.
+*/
+const size_t max_live_fields = 16;
+
+// the series a live layer plots: columns x and y (x 0 for the sample number)
+// of the lines read from source, keeping the last window samples
+struct LiveSpec {
+    std::string source;
+    char delim = ' ';
+    size_t window = 0;
+    size_t x_col = 0, y_col = 0;
+};
+
+// one line of a live stream
+struct LiveSample {
+    size_t number = 0;
+    size_t n_fields = 0;
+    double fields[max_live_fields];
+};
+
+template <typename T>
+class SpscQueue {
+    private:
+        std::vector<T> slots;
+        size_t mask;
+        // (apart, so the producer and consumer don't share a cache line)
+        alignas(64) std::atomic<size_t> head{0}; // next slot to pop
+        alignas(64) std::atomic<size_t> tail{0}; // next slot to push
+    public:
+        // capacity is rounded up to a power of 2
+        explicit SpscQueue(size_t capacity) {
+            size_t n = 1;
+            while (n < capacity)
+                n <<= 1;
+            slots.resize(n);
+            mask = n - 1;
+        }
+        // false if the queue is full
+        bool push(const T& value) {
+            size_t t = tail.load(std::memory_order_relaxed);
+            if (t - head.load(std::memory_order_acquire) > mask) {
+                return false;
+            }
+            slots[t & mask] = value;
+            tail.store(t + 1, std::memory_order_release);
+            return true;
+        }
+        // false if the queue is empty
+        bool pop(T& value) {
+            size_t h = head.load(std::memory_order_relaxed);
+            if (h == tail.load(std::memory_order_acquire)) {
+                return false;
+            }
+            value = slots[h & mask];
+            head.store(h + 1, std::memory_order_release);
+            return true;
+        }
+};
+
+// the last capacity values pushed, oldest first
+template <typename T>
+class RingBuffer {
+    private:
+        std::vector<T> values;
+        size_t start = 0, count = 0;
+    public:
+        explicit RingBuffer(size_t capacity) : values(std::max<size_t>(1, capacity)) {}
+        void push(const T& value) {
+            if (count < values.size()) {
+                values[(start + count++) % values.size()] = value;
+            } else {
+                values[start] = value;
+                start = (start + 1) % values.size();
+            }
+        }
+        size_t size() const { return count; }
+        const T& operator[](size_t i) const { return values[(start + i) % values.size()]; }
+};
+
+
+// the command line option that starts a layer
+struct LayerOption {
+    const char* name; // long option, e.g. "point"
+    int code;         // getopt code, e.g. 'P'
+    bool takes_file;  // the option's argument is the layer's data file
+};
+
+// base class
+class Layer {
+    private:
+        bool composed = false;
+        bool failed = false; // its data couldn't be prepared, so it can't be plotted
+        bool inline_data = false;
+        bool binary_data = false;
+        bool stream_data = false;
+        bool live_data = false;
+        LiveSpec live;
+        bool computed_data = false;
+        std::vector<Key> mapped; // aesthetics sent as columns, see _map_data()
+        std::string stream_src;
+        DataFrame frame; // x, y columns of inline (or loaded) data
+        DataFrame datablock_frame; // computed, added to the data store by finish()
+        std::string datablock_prefix;
+
+    protected:
+        Environment& global;
+        Environment& local;
+        DataStore& data;
+        void _fill_local(Key key, const std::string& _layer_default) {
+            // if key exists in local, do nothing. else, use global default if it
+            //   is set, else fill with the layer default
+            local.fill(key, global.get(key, _layer_default));
+        }
+        void _fill_global(Key key, const std::string& _layer_default) {
+            // if key exists in global, do nothing and send warning that the key
+            //   is already set.
+            // otherwise, fill with the local value if provided, or the layer default
+            global.insert(key, local.get(key, _layer_default));
+        }
+        // (in the arena of the plot, see ArenaScope)
+        Text set_command = "";
+        Text plot_command = ""; // the plot clause after its data source
+        Text source = "";       // e.g., 'data.dat', '-' or $DATA
+        Text data_file = "";    // file gnuplot reads directly, if any
+        
+        // pure virtual functions - must be implemented by derived classes
+        virtual void _update_globals() = 0;
+        virtual void _update_locals() = 0;
+        virtual void _set_setters() = 0;
+        virtual void _set_plotcmd() = 0;
+        // layers that draw data (geoms) override this to get inline/loaded data
+        virtual bool _draws_data() { return false; }
+        // the columns a layer reads from inline data (-x "1,2,3" -y "4,5,6")
+        virtual std::vector<Key> _aesthetics() { return {Key::x_data, Key::y_data}; }
+        // layers that draw a summary of their data (stats) override these, to
+        // replace the data with the summary (see _set_computed_data())
+        virtual bool _computes_data() { return false; }
+        virtual void _compute_data() {}
+        // layers with variable aesthetics (e.g., --size "($3)") override this,
+        // to list the ones they can map (see Scales)
+        virtual std::vector<Key> _mappable_aesthetics() { return {}; }
+        std::vector<Key> _mapped_aesthetics() {
+            std::vector<Key> aes;
+            for (Key a : _mappable_aesthetics()) {
+                if (is_expression(local[a]))
+                    aes.push_back(a);
+            }
+            return aes;
+        }
+        // the value of an aesthetic in the plot command: "variable" if it is
+        // mapped, or the layer default if it is an expression that couldn't be
+        void _mapped_value(Key key, const std::string& _default, Text& value) {
+            if (std::find(mapped.begin(), mapped.end(), key) != mapped.end()) {
+                value = "variable";
+            } else if (is_expression(local[key])) {
+                std::cerr << "Warning: " << key_name(key) << " can only be mapped to a column of a data file, using "
+                          << _default << "\n";
+                value = _default;
+            } else {
+                value = local[key];
+            }
+        }
+        void _resolve_data_file() {
+            /*
+            If the local file is "", then the user is defaulting to the global file.
+            If that is also blank, then we error.
+            If the local file is something else, then the user is overriding the
+            global file or they are explicitly specifying a file for each layer.
+            Note - no reason to have a default file specified by layers because
+            a file string has to be given by the user (either a path, "", or "-")
+            */
+            std::string local_file, global_file, resolved_file;
+            local_file = local.get(Key::file);
+            global_file = global.get(Key::file);
+            if (local_file == "") {
+                if (global_file != "") {
+                    resolved_file = global_file;
+                } else {
+                    std::cerr << "Error: no global data set, nothing to use as default\n";
+                    resolved_file = "";
+                }
+            } else {
+                resolved_file = local_file;
+            } 
+            local.replace(Key::file, resolved_file);
+        }
+        void _set_inline_data() {
+            if (local.get(Key::file) == "-" && local.get(Key::stream) != "" && local.number(Key::live) > 0) {
+                // samples are read by the live mode, see run_live()
+                _set_live_data();
+            } else if (local.get(Key::file) == "-" && local.get(Key::stream) != "") {
+                // data is read from the stream when it's written, see write_inline_data()
+                stream_data = true;
+                stream_src = local[Key::stream];
+                if (local.number(Key::binary) == 1) {
+                    std::cerr << "Warning: binary transport is not supported for streamed data, using text\n";
+                    local.replace(Key::binary, "0");
+                }
+            } else if (local.get(Key::file) == "-") {
+                std::vector<Key> aes = _aesthetics();
+                std::vector<std::vector<double>> values(aes.size());
+                size_t n_rows = std::numeric_limits<size_t>::max();
+                for (size_t i = 0; i < aes.size(); i++) {
+                    parse_numbers(local[aes[i]], values[i]);
+                    n_rows = std::min(n_rows, values[i].size());
+                }
+                for (size_t i = 0; i < aes.size(); i++) {
+                    if (values[i].size() != n_rows) {
+                        std::cerr << "Warning: inline " << aes_name(aes[i]) << " is longer than the other columns, truncating\n";
+                        values[i].resize(n_rows);
+                    }
+                    frame.add_column(aes_name(aes[i]), std::move(values[i]));
+                }
+                frame.drop_nan();
+                inline_data = true;
+            } else if (_downsampled() || _computes_data() || !_mapped_aesthetics().empty()) {
+                // the file is loaded below, there's no need to send all of it
+            } else if (_loads_file() && _derives_data()) {
+                if (_cache_dir() != "") {
+                    local.replace(Key::binary, "1"); // cached columns are sent as they are stored
+                }
+                StageTimer timer("transform", "expressions");
+                _derive_data();
+            } else if (_loads_file()) {
+                _load_file_data();
+            }
+            if (stream_data && _computes_data()) {
+                std::cerr << "Error: layer data can't be computed from a stream\n";
+            } else if (_computes_data()) {
+                StageTimer timer("transform", "stat");
+                _compute_data();
+            } else if (!_mapped_aesthetics().empty() && !inline_data && !stream_data && !live_data) {
+                if (_downsampled()) {
+                    std::cerr << "Warning: mapped layers aren't downsampled\n";
+                }
+                StageTimer timer("transform", "scales");
+                _map_data();
+            } else if (_downsampled() && (stream_data || live_data)) {
+                std::cerr << "Warning: --stream and --live layers aren't downsampled, their rows are sent as read\n";
+            } else if (_downsampled()) {
+                StageTimer timer("transform", "downsample");
+                _downsample_data();
+            }
+            binary_data = inline_data && local.number(Key::binary) == 1;
+        }
+        bool _downsampled() {
+            return local.number(Key::downsample) > 0;
+        }
+        // mark the layer as failed (after reporting why), so the plot isn't drawn
+        void _fail() { failed = true; }
+        void _set_live_data() {
+            live.source = stream_src = local[Key::stream];
+            live.window = static_cast<size_t>(local.number(Key::live));
+            live.delim = delim_char(local.get(Key::file_delim, global.get(Key::file_delim, " ")));
+            Text x = local[Key::x_data], y = local[Key::y_data];
+            if (x == "" || y == "" || x.find_first_not_of("0123456789") != std::string::npos
+                || y.find_first_not_of("0123456789") != std::string::npos) {
+                std::cerr << "Error: live columns must be given by number (-x 0 for the sample count)\n";
+                _fail();
+                return;
+            }
+            live.x_col = std::strtoul(x.c_str(), nullptr, 10);
+            live.y_col = std::strtoul(y.c_str(), nullptr, 10);
+            if (live.x_col > max_live_fields || live.y_col > max_live_fields || live.y_col == 0) {
+                std::cerr << "Error: live columns must be between 1 and " << max_live_fields << "\n";
+                _fail();
+                return;
+            }
+            live_data = true;
+            // the window is sent as (x, y) rows
+            local.replace(Key::x_data, "1");
+            local.replace(Key::y_data, "2");
+            if (local.number(Key::binary) == 1) {
+                std::cerr << "Warning: binary transport is not supported for live data, using text\n";
+                local.replace(Key::binary, "0");
+            }
+        }
+        // get the columns for the given aesthetics (e.g., {"x", "y"}) from the
+        // layer's source - its inline data, or its data file (loaded in-process)
+        // - with rows holding any NaN dropped. False if that isn't possible.
+        bool _source_columns(const std::vector<Key>& aes, DataFrame& out) {
+            out = DataFrame();
+            const DataFrame* src = &frame;
+            std::string_view file = local[Key::file];
+            if (!inline_data) {
+                Dataset* ds = (file != "" && file != "-") ? _load_dataset(file) : nullptr;
+                if (ds == nullptr) {
+                    return false;
+                }
+                src = &ds->frame;
+            }
+            for (Key a : aes) {
+                std::string var = inline_data ? aes_name(a) : std::string(local.get(a));
+                if (is_expression(var)) {
+                    std::vector<double> values;
+                    if (!_evaluate(var, *src, values)) {
+                        return false;
+                    }
+                    out.add_column(aes_name(a), std::move(values));
+                    continue;
+                }
+                int ix = src->find(var);
+                if (ix < 0) {
+                    std::cerr << "Error: column '" << var << "' not found in '" << file << "'\n";
+                    return false;
+                }
+                if (!_numeric_column(*src, ix, var)) {
+                    return false;
+                }
+                out.add_column(aes_name(a), src->column(ix));
+            }
+            out.drop_nan();
+            return true;
+        }
+        // false (failing the layer) if a column of a loaded file is text, which
+        // is all NaN in-process, so it would silently plot nothing
+        bool _numeric_column(const DataFrame& src, int ix, const std::string& var) {
+            if (!src.is_text(ix)) {
+                return true;
+            }
+            std::cerr << "Error: column '" << var << "' of '" << local[Key::file] << "' is text, which "
+                      << "can't be plotted from a file loaded in-process (--load, --cache, or several files)\n";
+            _fail();
+            return false;
+        }
+        // the value of a column expression for each row of src
+        bool _evaluate(const std::string& var, const DataFrame& src, std::vector<double>& values) {
+            Expression expr;
+            if (!expr.compile(var)) {
+                std::cerr << "Error: column expression '" << var << "' can't be evaluated in-process: "
+                          << expr.get_error() << "\n";
+                return false;
+            }
+            std::vector<const double*> cols;
+            for (const std::string& ref : expr.columns()) {
+                int ix = src.find(ref);
+                if (ix < 0) {
+                    std::cerr << "Error: column '" << ref << "' of '" << var << "' not found in '"
+                              << local[Key::file] << "'\n";
+                    return false;
+                }
+                if (!_numeric_column(src, ix, ref)) {
+                    return false;
+                }
+                cols.push_back(src.column(ix).data());
+            }
+            values = expr.evaluate(cols, src.nrow(), _thread_pool());
+            return true;
+        }
+        // whether the layer's columns are expressions the data can be
+        // computed from in-process (see _derive_data()). Cached files are sent
+        // as the columns the layer plots (in binary) unless one can't be.
+        bool _derives_data() {
+            bool any = _cache_dir() != "";
+            for (Key a : _aesthetics()) {
+                std::string_view var = local.get(a);
+                if (!is_expression(var))
+                    continue;
+                Expression expr;
+                if (!expr.compile(var)) {
+                    std::cerr << "Warning: column expression '" << var << "' is left to gnuplot: "
+                              << expr.get_error() << "\n";
+                    return false;
+                }
+                any = true;
+            }
+            return any;
+        }
+        // with --load, send only the columns the layer plots, with its column
+        // expressions computed, instead of gnuplot evaluating them for each row
+        void _derive_data() {
+            DataFrame derived;
+            if (!_source_columns(_aesthetics(), derived)) {
+                std::cerr << "Error: could not compute layer data\n";
+                return;
+            }
+            _set_computed_data(std::move(derived));
+        }
+        // send the layer's x, y and the scaled values of its mapped aesthetics
+        // (sizes first, then colors, as gnuplot reads "variable" columns)
+        void _map_data() {
+            std::vector<Key> aes = {Key::x_data, Key::y_data};
+            std::vector<Key> m = _mapped_aesthetics();
+            for (Key a : {Key::size, Key::color}) {
+                if (std::find(m.begin(), m.end(), a) != m.end())
+                    aes.push_back(a);
+            }
+            DataFrame columns;
+            if (!_source_columns(aes, columns)) {
+                std::cerr << "Error: could not map layer data\n";
+                return;
+            }
+            ThreadPool& pool = _thread_pool();
+            DataFrame computed;
+            computed.add_column("x", std::move(columns.column(0)));
+            computed.add_column("y", std::move(columns.column(1)));
+            for (size_t i = 2; i < aes.size(); i++) {
+                if (aes[i] == Key::size) {
+                    computed.add_column("size", scale_sizes(columns.column(i), pool));
+                } else {
+                    computed.add_column("color", scale_colors(columns.column(i), pool));
+                }
+            }
+            mapped.assign(aes.begin() + 2, aes.end());
+            _set_computed_data(std::move(computed));
+        }
+        // replace the layer's data with the computed frame, sent as inline data
+        void _set_computed_data(DataFrame computed) {
+            frame = std::move(computed);
+            inline_data = true;
+            computed_data = true;
+            if (local[Key::file] != "-") {
+                local.replace(Key::source, local[Key::file]);
+                local.replace(Key::file, "-");
+            }
+            local.replace(Key::datablock, "");
+        }
+        // replace the layer's data with the computed frame, sent as its own
+        // datablock (for layers that read it in more than one plot clause)
+        // (added when the layer is finished, so datablocks are numbered in
+        // layer order)
+        void _set_computed_datablock(DataFrame computed, const std::string& prefix) {
+            datablock_frame = std::move(computed);
+            datablock_prefix = prefix;
+            inline_data = false;
+            computed_data = true;
+            frame = DataFrame();
+            local.replace(Key::source, local[Key::file]);
+        }
+        void _add_computed_datablock() {
+            Dataset* ds = data.add(std::move(datablock_frame), datablock_prefix);
+            local.replace(Key::file, ds->name);
+            local.replace(Key::datablock, ds->name);
+        }
+        // reserve the dataset of the layer's file if it will be loaded, so that
+        // datasets are named in layer order, however the layers' data is prepared
+        void _reserve_dataset() {
+            std::string_view file = local.get(Key::file);
+            if (file != "" && file != "-"
+                && (_loads_file() || _downsampled() || _computes_data() || !_mapped_aesthetics().empty())) {
+                data.reserve(std::string(file), _row_filter(), _merge_column());
+            }
+        }
+        void _downsample_data() {
+            std::string method(local.get(Key::downsample_method, "lttb"));
+            if (method != "lttb" && method != "minmax") {
+                std::cerr << "Error: unknown downsample method '" << method << "', using lttb\n";
+                method = "lttb";
+            }
+            // (lttb keeps the first and last points and one per bucket in
+            // between, minmax two per bucket)
+            size_t min_out = (method == "minmax") ? 2 : 3;
+            if (local.number(Key::downsample) < min_out) {
+                std::cerr << "Error: --downsample " << local[Key::downsample] << " is too few points, "
+                          << method << " needs at least " << min_out << "\n";
+                _fail();
+                return;
+            }
+            DataFrame xy;
+            if (!_source_columns({Key::x_data, Key::y_data}, xy)) {
+                std::cerr << "Error: could not downsample layer data\n";
+                return;
+            }
+            size_t n_out = static_cast<size_t>(local.number(Key::downsample));
+            std::vector<double> x, y;
+            if (method == "minmax") {
+                downsample_minmax(xy.column(0), xy.column(1), n_out, x, y);
+            } else {
+                downsample_lttb(xy.column(0), xy.column(1), n_out, x, y);
+            }
+            DataFrame computed;
+            computed.add_column("x", std::move(x));
+            computed.add_column("y", std::move(y));
+            _set_computed_data(std::move(computed));
+        }
+        void _load_file_data() {
+            // parse the file in-process (once, for all layers that use it), and
+            // have gnuplot read it from the shared datablock instead
+            Dataset* ds = _load_dataset(local[Key::file]);
+            if (ds == nullptr) {
+                return;
+            }
+            // (gnuplot can read a text column from the file itself, but not a
+            // multi-file source)
+            for (Key a : _aesthetics()) {
+                std::string var(local.get(a));
+                int ix = (var == "" || is_expression(var)) ? -1 : ds->frame.find(var);
+                if (ix < 0 || !ds->frame.is_text(ix)) {
+                    continue;
+                }
+                if (is_multi_source(local.get(Key::file))) {
+                    _numeric_column(ds->frame, ix, var);
+                } else {
+                    std::cerr << "Warning: column '" << var << "' of '" << local[Key::file]
+                              << "' is text, leaving the file to gnuplot rather than loading it\n";
+                }
+                return;
+            }
+            ds->referenced = true;
+            local.replace(Key::datablock, ds->name);
+        }
+        ThreadPool& _thread_pool() {
+            return data.thread_pool(static_cast<size_t>(global.number(Key::threads)));
+        }
+        Dataset* _load_dataset(std::string_view file) {
+            char delim = delim_char(local.get(Key::file_delim, global.get(Key::file_delim, " ")));
+            return data.load(std::string(file), delim, static_cast<size_t>(global.number(Key::threads)),
+                             std::string(_cache_dir()), _row_filter(), _merge_column());
+        }
+        // the rows of a loaded file the layer plots: those with x in --xlim,
+        // unless x is an expression (then gnuplot's xrange drops the others)
+        RowFilter _row_filter() {
+            RowFilter filter;
+            std::string_view x = local.get(Key::x_data);
+            if (global.get(Key::xlim) != "" && x != "" && !is_expression(x)
+                && parse_limits(global.get(Key::xlim), filter.lo, filter.hi)) {
+                filter.column = x;
+            }
+            return filter;
+        }
+        // the directory of the columnar cache of loaded files, "" for none
+        std::string_view _cache_dir() {
+            return local.get(Key::cache, global.get(Key::cache));
+        }
+        // the column the files of a multi-file source are merged by (--merge),
+        // "" to take them one after another
+        std::string _merge_column() {
+            std::string_view x = local.get(Key::x_data);
+            if (local.get(Key::merge, global.get(Key::merge)) != "1" || !is_multi_source(local.get(Key::file))
+                || is_expression(x)) {
+                return "";
+            }
+            return std::string(x);
+        }
+        // whether the layer's file is parsed in-process (a cached file is too,
+        // and the files of a multi-file source, which gnuplot can't read)
+        bool _loads_file() {
+            std::string_view file = local.get(Key::file);
+            return (local.number(Key::load) == 1 || _cache_dir() != "" || is_multi_source(file)) && file != "";
+        }
+        // the data source at the start of a plot clause
+        Text _source_str() {
+            Text block(local.get(Key::datablock));
+            return (block != "") ? block : "'" + local[Key::file] + "'";
+        }
+        Text _using_str() {
+            return using_str_from_local(local, frame.nrow(), std::max<size_t>(2, frame.ncol()));
+        }
+    public:
+        Layer(Environment& global, Environment& local, DataStore& data)
+            : global(global), local(local), data(data) {}
+
+        // compose the layer based on the current global state and its local
+        // one - in layer order, since layers update the global state
+        void compose() {
+            // make all updates to shared objects
+            _update_globals();
+            _update_locals();
+            // make all updates to local objects
+            _set_setters();
+            if (_draws_data()) {
+                _reserve_dataset();
+            }
+        }
+        // get the layer's data (inline data, or its loaded file, transformed or
+        // computed) - only reading the global state, so any number of layers
+        // may be prepared at once
+        void prepare_data() {
+            if (_draws_data()) {
+                _set_inline_data(); // before the plot command, which may need the record count
+            }
+        }
+        // set the plot command once the data is prepared, in layer order
+        void finish() {
+            if (datablock_prefix != "") {
+                _add_computed_datablock();
+            }
+            _set_plotcmd();
+            if (_draws_data()) {
+                // kept apart from the plot command so it can be rebound later
+                source = _source_str();
+                if (local.get(Key::datablock) == "" && local[Key::file] != "-") {
+                    data_file = local[Key::file];
+                }
+            }
+            composed = true;
+        }
+        Text get_set_line() {
+            if (!composed) {
+                std::cerr << "Error: layer not composed, cannot get set line\n";
+                return "";
+            }
+            return set_command;
+        }
+        Text get_plot_line() {
+            if (!composed) {
+                std::cerr << "Error: layer not composed, cannot get plot line\n";
+                return "";
+            }
+            if (plot_command == "") {
+                return "";
+            }
+            return source + " " + plot_command;
+        }
+        // the data file gnuplot will read for this layer, "" if the data is
+        // inline or comes from a datablock
+        std::string get_data_file() { return std::string(data_file); }
+        // the data source of the layer's plot clause, e.g. 'data.dat' or $DATA
+        std::string get_source() { return std::string(source); }
+        // the layer's plot clause, reading another data source (e.g., a facet's
+        // panel), "" if it has none
+        Text get_plot_line(std::string_view _source) {
+            if (!composed || plot_command == "") {
+                return "";
+            }
+            return Text(_source) + " " + plot_command;
+        }
+        // point the layer's plot clause at another data source (e.g., a datablock)
+        void set_source(std::string_view _source) {
+            source = _source;
+            data_file = "";
+        }
+        // write this layer's inline data (if any) into the gnuplot script
+        void write_inline_data(PipeWriter& out) {
+            if (!composed) {
+                std::cerr << "Error: layer not composed, cannot get inline data\n";
+                return;
+            }
+            if (stream_data) {
+                forward_stream(stream_src, out);
+            } else if (binary_data) {
+                // raw bytes, no terminator - gnuplot stops after the record count
+                frame.write_binary(out);
+            } else if (inline_data) {
+                frame.write_text(out, delim_char(global.get(Key::file_delim, " ")));
+                out.write("e\n");
+            }
+        }
+        std::string get_inline_data() {
+            std::string result = "";
+            PipeWriter out(result);
+            write_inline_data(out);
+            return result;
+        }
+        // false if the layer's data couldn't be prepared
+        bool ok() { return !failed; }
+        bool reads_stdin() { return (stream_data || live_data) && stream_src == "-"; }
+        bool reads_stream() { return stream_data; }
+        // the live series the layer plots, if any (see run_live())
+        const LiveSpec* get_live() { return live_data ? &live : nullptr; }
+        // true if the layer plots data computed from its source (e.g., bins)
+        bool has_computed_data() { return computed_data; }
+};
+
+
+/* Base Layer
+* The base layer is a special layer that can only be included once at the start
+* of the plot, where the user can define data and aesthetic options that will then
+* apply to any preceding layer, unless overwritten. This is equivalent to ggplot()
+* in ggplot2 - e.g.,
+* `ggplot(data = data, aes(x = x, y = y, color = color)) + geom_point(aes(shape = shape))`
+* defines a data set and aesthetics to be used for all preceding layers.
+* 
+*/
+class BaseLayer : public Layer {
+    protected:
+        std::string gd_file_delim = " "; // "global default -> gd"
+        std::string gd_x_data = "1";
+        std::string gd_y_data = "1";
+        std::string gd_color = "black";
+        std::string gd_shape = "1";
+        std::string gd_binary = "0";
+        std::string gd_load = "0";
+        std::string gd_threads = "0"; // one per core
+        std::string gd_cache = "";
+        std::string gd_xlim = "";
+        std::string gd_merge = "0";
+    public:
+        static constexpr LayerOption option = {"global",    'G', true};  // gg ggplot()
+        using Layer::Layer;
+        void _update_globals() override {
+            if (local.get(Key::file) == "-") {
+                std::cerr << "Error: the base layer cannot use inline data, ignoring\n";
+                global.insert(Key::file, "");
+            } else {
+                global.insert(Key::file, local.get(Key::file, ""));
+            }
+            _fill_global(Key::file_delim, gd_file_delim);
+            _fill_global(Key::x_data, gd_x_data);
+            _fill_global(Key::y_data, gd_y_data);
+            _fill_global(Key::color, gd_color);
+            _fill_global(Key::shape, gd_shape);
+            _fill_global(Key::binary, gd_binary);
+            _fill_global(Key::load, gd_load);
+            _fill_global(Key::threads, gd_threads);
+            _fill_global(Key::cache, gd_cache);
+            _fill_global(Key::xlim, gd_xlim);
+            _fill_global(Key::merge, gd_merge);
+        };
+        void _update_locals() override {
+            return;
+        };
+        void _set_setters() override {
+            set_command += "set datafile separator '" + global[Key::file_delim] + "'\n";
+            double lo, hi;
+            if (global[Key::xlim] != "" && !parse_limits(global[Key::xlim], lo, hi)) {
+                std::cerr << "Error: --xlim must be lo:hi (either may be left out), ignoring\n";
+                global.replace(Key::xlim, "");
+            } else if (global[Key::xlim] != "") {
+                set_command += "set xrange [" + global[Key::xlim] + "]\n";
+            }
+            if ((global.number(Key::load) == 1 || global[Key::cache] != "" || is_multi_source(global[Key::file]))
+                && global[Key::file] != "") {
+                data.reserve(std::string(global[Key::file]), _row_filter(), _merge_column()); // first, so it's $DATA
+            }
+        };
+        void _set_plotcmd() override {
+            return;
+        };
+};
+
+
+
+// Labs layer (E.g., for axis labels)
+class LabsLayer : public Layer {
+    protected:
+        std::string gd_title = "";
+        std::string gd_xlab = "x";
+        std::string gd_ylab = "y";
+    public:
+        static constexpr LayerOption option = {"labs",      500, false};  // gg labs()
+        using Layer::Layer;
+        void _update_globals() override {
+            _fill_global(Key::title, gd_title);
+            _fill_global(Key::xlab, gd_xlab);
+            _fill_global(Key::ylab, gd_ylab);
+            return;
+        }
+        void _update_locals() override {
+            return;
+        }
+        void _set_setters() override {
+            set_command += "set title '" + global[Key::title] + "'\n";
+            set_command += "set xlabel '" + global[Key::xlab] + "'\n";
+            set_command += "set ylabel '" + global[Key::ylab] + "'\n";
+        }
+        void _set_plotcmd() override {
+            return;
+        }
+};
+
+
+// Theme Layer (E.g., for legend position)
+class ThemeLayer : public Layer {
+    protected:
         std::string gd_legend_position = "right";
         std::string gd_legend_direction = "vertical";
     public:
+        static constexpr LayerOption option = {"theme",     600, false};  // gg theme()
+        using Layer::Layer;
+        void _update_globals() override {
+            _fill_global(Key::legend_position, gd_legend_position);
+            _fill_global(Key::legend_direction, gd_legend_direction);
+            return;
+        }
+        void _update_locals() override {
+            return;
+        }
+        void _set_setters() override {
+            std::string leg;
+            if (global[Key::legend_position] == "none") {
+                leg = "off";
+            } else if (global[Key::legend_position] == "right" ||
+                       global[Key::legend_position] == "left") {
+                leg = "outside " + global[Key::legend_position] + " center " +
+                      global[Key::legend_direction];
+            } else if (global[Key::legend_position] == "top" ||
+                       global[Key::legend_position] == "bottom") {
+                leg = "outside center " + global[Key::legend_position] + " " +
+                      global[Key::legend_direction];
+            } else {
+                std::cerr << "Error: invalid legend position '" <<
+                                   global[Key::legend_position] << "', ignoring\n";
+                leg = "off";
+            }
+            set_command += "set key " + leg + "\n";
+        }
+        void _set_plotcmd() override {
+            return;
+        }
+};
+
+
+// Facet Layer: one panel per value of -x (gg facet_wrap()), or per row (-y)
+// and column (-x) value (gg facet_grid()), see Facets
+class FacetLayer : public Layer {
+    protected:
+        std::string gd_facet_x = "";
+        std::string gd_facet_y = "";
+        std::string gd_ncol = "0"; // panels per row of a wrap, 0 to make it about square
+    public:
+        static constexpr LayerOption option = {"facet",     900, false};  // gg facet_wrap(), facet_grid()
+        using Layer::Layer;
+        void _update_globals() override {
+            if (local.get(Key::facet_x) == "" && local.get(Key::facet_y) == "") {
+                std::cerr << "Warning: --facet needs a column (-x, or -y and -x for a grid), drawing one panel\n";
+            }
+            _fill_global(Key::facet_x, gd_facet_x);
+            _fill_global(Key::facet_y, gd_facet_y);
+            _fill_global(Key::ncol, gd_ncol);
+        }
+        void _update_locals() override {
+            return;
+        }
+        void _set_setters() override {
+            return;
+        }
+        void _set_plotcmd() override {
+            return;
+        }
+};
+
+
+// Point layer
+class PointLayer : public Layer {
+    protected:
+        std::string d_x_data = "1";
+        std::string d_y_data = "1";
+        std::string d_color = "black";
+        std::string d_shape = "8";
+        std::string d_size = "1";
+        std::string d_label = "";
+        std::string d_binary = "0";
+        std::string d_load = "0";
+        std::string d_downsample = "0"; // target number of points, 0 for all
+        std::string d_downsample_method = "lttb";
+    public:
+        static constexpr LayerOption option = {"point",     'P', true};  // gg geom_point()
+        using Layer::Layer;
+        bool _draws_data() override { return true; }
+        std::vector<Key> _mappable_aesthetics() override { return {Key::size, Key::color}; }
+        void _update_globals() override {
+            return;
+        }
+        void _update_locals() override {
+            _resolve_data_file();
+            _fill_local(Key::x_data, d_x_data);
+            _fill_local(Key::y_data, d_y_data);
+            _fill_local(Key::color,  d_color);
+            _fill_local(Key::shape,  d_shape);
+            _fill_local(Key::size,  d_size);
+            _fill_local(Key::label, d_label);
+            _fill_local(Key::binary, d_binary);
+            _fill_local(Key::load, d_load);
+            _fill_local(Key::downsample, d_downsample);
+            _fill_local(Key::downsample_method, d_downsample_method);
+        }
+        void _set_setters() override {
+            return;
+        }
+        void _set_plotcmd() override {
+            Text using_str = _using_str();            
+            Text title_str = (local[Key::label] == "") ? "notitle" :
+                                    " title '" + local[Key::label] + "'";
+            Text size, color;
+            _mapped_value(Key::size, d_size, size);
+            _mapped_value(Key::color, d_color, color);
+            plot_command +=
+                using_str + " with points"
+                + " pointtype " + local[Key::shape]
+                + " pointsize " + size
+                + " linecolor rgb " + (color == "variable" ? color : "'" + color + "'")
+                + " " + title_str
+                ;
+        };
+};
+
+
+// LineLayer
+class LineLayer : public Layer {
+    protected:
+        std::string d_x_data = "1";
+        std::string d_y_data = "1";
+        std::string d_color = "black";
+        std::string d_linetype = "1";
+        std::string d_linewidth = "1";
+        std::string d_label = "";
+        std::string d_binary = "0";
+        std::string d_load = "0";
+        std::string d_downsample = "0"; // target number of points, 0 for all
+        std::string d_downsample_method = "lttb";
+    public:
+        static constexpr LayerOption option = {"line",      'L', true};  // gg geom_line()
         using Layer::Layer;
+        bool _draws_data() override { return true; }
+        std::vector<Key> _mappable_aesthetics() override { return {Key::color}; }
         void _update_globals() override {
-            _fill_global("legend_position", gd_legend_position);
-            _fill_global("legend_direction", gd_legend_direction);
             return;
         }
-        void _update_locals() override {
-            return;
+        void _update_locals() override {
+            _resolve_data_file();
+            _fill_local(Key::x_data, d_x_data);
+            _fill_local(Key::y_data, d_y_data);
+            _fill_local(Key::color,  d_color);
+            _fill_local(Key::linetype,  d_linetype);
+            _fill_local(Key::linewidth,  d_linewidth);
+            _fill_local(Key::label, d_label);
+            _fill_local(Key::binary, d_binary);
+            _fill_local(Key::load, d_load);
+            _fill_local(Key::downsample, d_downsample);
+            _fill_local(Key::downsample_method, d_downsample_method);
+        }
+        void _set_setters() override {
+            return;
+        }
+        void _set_plotcmd() override {
+            Text using_str = _using_str();            
+            Text title_str = (local[Key::label] == "") ? "notitle" :
+                                    " title '" + local[Key::label] + "'";
+            Text color;
+            _mapped_value(Key::color, d_color, color);
+            plot_command +=
+                using_str + " with lines"
+                + " linetype " + local[Key::linetype] // TODO: check if linetype is a number or string - if string, wrap in quotes
+                + " linewidth " + local[Key::linewidth]
+                + " linecolor rgb " + (color == "variable" ? color : "'" + color + "'")
+                + " " + title_str
+                ;
+        };
+};
+    
+
+// Bar layer
+class BarLayer : public Layer {
+    protected:
+        std::string d_x_data = "1";
+        std::string d_y_data = "1";
+        std::string d_color = "black";
+        std::string d_shape = "1";
+        std::string gd_fillstyle = "solid";
+        std::string gd_width = "0.8";
+        std::string d_label = "";
+        std::string d_binary = "0";
+        std::string d_load = "0";
+    public:
+        static constexpr LayerOption option = {"bar",       'B', true};  // gg geom_bar()
+        using Layer::Layer;
+        bool _draws_data() override { return true; }
+        void _update_globals() override {
+            _fill_global(Key::width, gd_width);
+            _fill_global(Key::fillstyle, gd_fillstyle);
+        }
+        void _update_locals() override {
+            _resolve_data_file();
+            _fill_local(Key::x_data, d_x_data);
+            _fill_local(Key::y_data, d_y_data);
+            _fill_local(Key::color, d_color);
+            _fill_local(Key::shape, d_shape);
+            _fill_local(Key::binary, d_binary);
+            _fill_local(Key::load, d_load);
+        }
+        void _set_setters() override {
+            set_command += "set style fill " + global[Key::fillstyle] + "\n";
+            set_command += "set boxwidth " + global[Key::width] + " relative\n";
+        }
+        void _set_plotcmd() override {
+            Text using_str = _using_str();
+            Text title_str = (local[Key::label] == "") ? "notitle" :
+                                    " title '" + local[Key::label] + "'";
+            plot_command +=
+                using_str + " with boxes"
+                + " fillstyle " + local[Key::fillstyle]
+                + " linecolor rgb '" + local[Key::color] + "'"
+                + " " + title_str
+                ;
+        }
+};
+
+
+
+// Histogram layer: counts of x in equal-width bins, drawn as bars. The counts
+// are computed in-process, so only the bins are sent to gnuplot.
+class HistogramLayer : public BarLayer {
+    protected:
+        std::string d_bins = "30";
+        std::string d_binwidth = ""; // overrides the number of bins if set
+    public:
+        static constexpr LayerOption option = {"histogram", 'H', true};  // gg geom_histogram()
+        HistogramLayer(Environment& global, Environment& local, DataStore& data)
+            : BarLayer(global, local, data) {
+            gd_width = "1"; // adjacent bins touch
+        }
+        std::vector<Key> _aesthetics() override { return {Key::x_data}; }
+        bool _computes_data() override { return true; }
+        void _update_locals() override {
+            _resolve_data_file();
+            _fill_local(Key::x_data, d_x_data);
+            _fill_local(Key::color, d_color);
+            _fill_local(Key::shape, d_shape);
+            _fill_local(Key::binary, d_binary);
+            _fill_local(Key::bins, d_bins);
+            _fill_local(Key::binwidth, d_binwidth);
+        }
+        void _compute_data() override {
+            DataFrame xs;
+            if (!_source_columns({Key::x_data}, xs)) {
+                std::cerr << "Error: could not compute histogram of layer data\n";
+                return;
+            }
+            const std::vector<double>& x = xs.column(0);
+            if (x.empty()) {
+                std::cerr << "Warning: no data for histogram\n";
+            }
+            ThreadPool& pool = _thread_pool();
+            Bins bins;
+            if (!make_bins(x, pool, std::strtoul(local[Key::bins].c_str(), nullptr, 10),
+                           std::strtod(local[Key::binwidth].c_str(), nullptr), bins)) {
+                _fail();
+                return;
+            }
+            std::vector<double> centers(bins.n);
+            for (size_t b = 0; b < bins.n; b++) {
+                centers[b] = bins.center(b);
+            }
+            DataFrame computed;
+            computed.add_column("x", std::move(centers));
+            computed.add_column("y", histogram_counts(x, bins, pool));
+            _set_computed_data(std::move(computed));
+        }
+};
+
+// 2D bin layer: counts of (x, y) points in the cells of a rectangular grid,
+// drawn as an image colored by the palette. Like the histogram, the counts are
+// computed in-process, so gnuplot only draws the grid however many points
+// there are. --bins and --binwidth take one value for both axes, or "x,y".
+class Bin2dLayer : public Layer {
+    protected:
+        std::string d_x_data = "1";
+        std::string d_y_data = "2";
+        std::string d_bins = "30";
+        std::string d_binwidth = "";
+        std::string gd_palette = "defined (0 '#132b43', 1 '#56b1f7')";
+        std::string d_label = "";
+        // the setting for one axis (0 for x, 1 for y) of a "value" or "x,y" option
+        static std::string _axis_value(std::string_view value, size_t axis) {
+            std::vector<std::string_view> parts = parse_data(value);
+            return parts.empty() ? "" : std::string(parts[std::min(axis, parts.size() - 1)]);
+        }
+    public:
+        static constexpr LayerOption option = {"bin2d",     'D', true};  // gg geom_bin2d()
+        using Layer::Layer;
+        bool _draws_data() override { return true; }
+        bool _computes_data() override { return true; }
+        void _update_globals() override {
+            _fill_global(Key::palette, gd_palette);
+        }
+        void _update_locals() override {
+            _resolve_data_file();
+            _fill_local(Key::x_data, d_x_data);
+            _fill_local(Key::y_data, d_y_data);
+            _fill_local(Key::bins, d_bins);
+            _fill_local(Key::binwidth, d_binwidth);
+            _fill_local(Key::label, d_label);
+            // the grid is small, and images need its shape, which a binary
+            // record count doesn't give
+            local.replace(Key::binary, "0");
+        }
+        void _set_setters() override {
+            set_command += "set palette " + global[Key::palette] + "\n";
+        }
+        void _compute_data() override {
+            DataFrame xy;
+            if (!_source_columns({Key::x_data, Key::y_data}, xy)) {
+                std::cerr << "Error: could not compute 2d bins of layer data\n";
+                return;
+            }
+            if (xy.nrow() == 0) {
+                std::cerr << "Warning: no data for 2d bins\n";
+            }
+            ThreadPool& pool = _thread_pool();
+            Bins axis_bins[2];
+            for (size_t axis = 0; axis < 2; axis++) {
+                if (!make_bins(xy.column(axis), pool,
+                               std::strtoul(_axis_value(local[Key::bins], axis).c_str(), nullptr, 10),
+                               std::strtod(_axis_value(local[Key::binwidth], axis).c_str(), nullptr),
+                               axis_bins[axis])) {
+                    _fail();
+                    return;
+                }
+            }
+            const Bins& x_bins = axis_bins[0];
+            const Bins& y_bins = axis_bins[1];
+            if (x_bins.n * y_bins.n > max_bins) { // (each is at most max_bins, so this doesn't overflow)
+                std::cerr << "Error: at most " << max_bins << " 2d bins, got " << x_bins.n << " x "
+                          << y_bins.n << "\n";
+                _fail();
+                return;
+            }
+            std::vector<double> x(x_bins.n * y_bins.n), y(x.size());
+            for (size_t j = 0; j < y_bins.n; j++) {
+                for (size_t i = 0; i < x_bins.n; i++) {
+                    x[j * x_bins.n + i] = x_bins.center(i);
+                    y[j * x_bins.n + i] = y_bins.center(j);
+                }
+            }
+            DataFrame computed;
+            computed.add_column("x", std::move(x));
+            computed.add_column("y", std::move(y));
+            computed.add_column("count", bin2d_counts(xy.column(0), xy.column(1), x_bins, y_bins, pool));
+            _set_computed_data(std::move(computed));
+        }
+        void _set_plotcmd() override {
+            Text title_str = (local[Key::label] == "") ? "notitle" :
+                                    " title '" + local[Key::label] + "'";
+            // empty cells are undefined, so they aren't drawn
+            plot_command +=
+                "using 1:2:($3 > 0 ? $3 : NaN) with image"
+                + Text(" ") + title_str
+                ;
+        }
+};
+
+
+
+
+// Smooth layer: a fitted curve through (x, y), with a ribbon for its 95%
+// confidence band (--se 0 for none), drawn like a line layer. --method is
+// "loess" (local quadratic, span --span), "lm" (a straight line) or "bin" (the
+// mean in each of --bins bins). The default is loess for fewer than 1000
+// points, and the single-pass bin means above that.
+class SmoothLayer : public LineLayer {
+    protected:
+        std::string d_method = "auto";
+        std::string d_span = "0.75";
+        std::string d_se = "1";
+        std::string d_bins = "30";
+        std::string d_ribbon = "gray60";
+        const size_t n_curve = 80; // points the loess and lm curves are evaluated at
+    public:
+        static constexpr LayerOption option = {"smooth",    'S', true};  // gg geom_smooth()
+        SmoothLayer(Environment& global, Environment& local, DataStore& data)
+            : LineLayer(global, local, data) {
+            d_color = "#3366ff";
+            d_linewidth = "2";
+        }
+        bool _computes_data() override { return true; }
+        void _update_locals() override {
+            LineLayer::_update_locals();
+            _fill_local(Key::method, d_method);
+            _fill_local(Key::span, d_span);
+            _fill_local(Key::se, d_se);
+            _fill_local(Key::bins, d_bins);
+            _fill_local(Key::ribbon, d_ribbon);
+        }
+        void _compute_data() override {
+            DataFrame xy;
+            if (!_source_columns({Key::x_data, Key::y_data}, xy)) {
+                std::cerr << "Error: could not smooth layer data\n";
+                return;
+            }
+            const std::vector<double>& x = xy.column(0);
+            const std::vector<double>& y = xy.column(1);
+            ThreadPool& pool = _thread_pool();
+            std::string method(local[Key::method]);
+            if (method == "auto") {
+                method = (x.size() < 1000) ? "loess" : "bin";
+            }
+            Curve curve;
+            if (method == "lm") {
+                smooth_lm(x, y, n_curve, pool, curve);
+            } else if (method == "bin") {
+                Bins bins;
+                if (!make_bins(x, pool, std::strtoul(local[Key::bins].c_str(), nullptr, 10), 0, bins)) {
+                    _fail();
+                    return;
+                }
+                smooth_bins(x, y, bins, pool, curve);
+            } else {
+                if (method != "loess") {
+                    std::cerr << "Error: unknown smoothing method '" << method << "', using loess\n";
+                }
+                smooth_loess(x, y, n_curve, local.number(Key::span), curve);
+            }
+            if (curve.x.empty()) {
+                std::cerr << "Warning: not enough data to smooth\n";
+            }
+            const double z = 1.96; // normal quantile for the 95% band
+            std::vector<double> lower(curve.x.size()), upper(curve.x.size());
+            for (size_t i = 0; i < curve.x.size(); i++) {
+                lower[i] = curve.y[i] - z * curve.se[i];
+                upper[i] = curve.y[i] + z * curve.se[i];
+            }
+            DataFrame computed;
+            computed.add_column("x", std::move(curve.x));
+            computed.add_column("y", std::move(curve.y));
+            computed.add_column("ymin", std::move(lower));
+            computed.add_column("ymax", std::move(upper));
+            _set_computed_datablock(std::move(computed), "$SMOOTH");
+            local.replace(Key::x_data, "1");
+            local.replace(Key::y_data, "2");
+        }
+        void _set_plotcmd() override {
+            if (local.number(Key::se) != 0 && local.get(Key::datablock) != "") {
+                // the ribbon first, so the line is drawn over it
+                plot_command +=
+                    "using 1:3:4 with filledcurves"
+                    + Text(" fillcolor rgb '") + local[Key::ribbon] + "'"
+                    + " fillstyle transparent solid 0.4 noborder notitle, "
+                    + local[Key::datablock] + " "
+                    ;
+            }
+            LineLayer::_set_plotcmd();
+        }
+};
+
+
+/* Layer registry
+* Every layer type, with the option that starts it. A plot's layers are held by
+* value in one vector of variants, so adding a layer doesn't allocate it on its
+* own, and the layers' command line options are generated from this list too.
+*/
+template <typename... Ls>
+struct LayerTypes {
+    using Variant = std::variant<Ls...>;
+    static constexpr size_t size = sizeof...(Ls);
+    static constexpr LayerOption options[] = {Ls::option...};
+
+    // the layer option with the given getopt code, or nullptr
+    static constexpr const LayerOption* find(int code) {
+        for (const auto& opt : options) {
+            if (opt.code == code)
+                return &opt;
+        }
+        return nullptr;
+    }
+    // add the layer started by the option code, false if there's none
+    static bool emplace(std::vector<Variant>& layers, int code,
+                        Environment& global, Environment& local, DataStore& data) {
+        bool found = false;
+        ((found = found || (Ls::option.code == code
+                            && (layers.emplace_back(std::in_place_type<Ls>, global, local, data), true))), ...);
+        return found;
+    }
+};
+
+using Layers = LayerTypes<BaseLayer, PointLayer, LineLayer, BarLayer, HistogramLayer,
+                          Bin2dLayer, SmoothLayer, LabsLayer, ThemeLayer, FacetLayer>;
+
+// a plot's layers, in order, seen as Layers
+class LayerList {
+    private:
+        std::vector<Layers::Variant> layers;
+    public:
+        class iterator {
+            private:
+                LayerList* list;
+                size_t i;
+            public:
+                iterator(LayerList* list, size_t i) : list(list), i(i) {}
+                Layer& operator*() const { return (*list)[i]; }
+                iterator& operator++() { i++; return *this; }
+                bool operator!=(const iterator& other) const { return i != other.i; }
+        };
+        size_t size() const { return layers.size(); }
+        Layer& operator[](size_t i) {
+            return std::visit([](auto& layer) -> Layer& { return layer; }, layers[i]);
+        }
+        // the name of the option that started the i-th layer, e.g. "point"
+        const char* name(size_t i) const {
+            return std::visit([](const auto& layer) { return std::decay_t<decltype(layer)>::option.name; },
+                              layers[i]);
+        }
+        iterator begin() { return iterator(this, 0); }
+        iterator end() { return iterator(this, layers.size()); }
+        // add the layer started by the option code, nullptr if there's none
+        Layer* add(int code, Environment& global, Environment& local, DataStore& data) {
+            if (!Layers::emplace(layers, code, global, local, data)) {
+                return nullptr;
+            }
+            return &(*this)[layers.size() - 1];
+        }
+};
+
+// the getopt table: the layer options, then the given ones
+template <size_t N>
+constexpr std::array<option, Layers::size + N + 1> make_long_options(const option (&others)[N]) {
+    std::array<option, Layers::size + N + 1> all{};
+    size_t i = 0;
+    for (const auto& opt : Layers::options) {
+        all[i++] = {opt.name, opt.takes_file ? required_argument : no_argument, nullptr, opt.code};
+    }
+    for (const auto& opt : others) {
+        all[i++] = opt;
+    }
+    all[i] = {nullptr, 0, nullptr, 0};
+    return all;
+}
+
+// the getopt short options: those of the layers with a one-letter code (with
+// a ':' if they take a file), then the given ones (e.g., "x:y:")
+template <size_t N>
+constexpr std::array<char, 2 * Layers::size + N> make_short_options(const char (&others)[N]) {
+    std::array<char, 2 * Layers::size + N> all{};
+    size_t i = 0;
+    for (const auto& opt : Layers::options) {
+        if (opt.code > 0 && opt.code < 128) {
+            all[i++] = static_cast<char>(opt.code);
+            if (opt.takes_file)
+                all[i++] = ':';
+        }
+    }
+    for (size_t j = 0; j < N; j++) {
+        all[i++] = others[j]; // (with the terminator)
+    }
+    return all;
+}
+
+
+// dispatch function to map command line arguments to layer types
+int add_layer(LayerList& layers,
+               int geom,
+               Environment& global,
+               Environment& local,
+               DataStore& data,
+               bool quiet = false) {
+    if (!quiet) {
+        std::cout << "Adding layer of type '" << geom << "'\n";
+    }
+
+    Layer* layer = layers.add(geom, global, local, data);
+    if (layer == nullptr) {
+        std::cerr << "Error: unknown layer type '" << geom << "'\n";
+        return EXIT_FAILURE;
+    }
+    StageTimer timer("compose", Layers::find(geom)->name);
+    layer->compose(); // its data is prepared once every layer is composed, see prepare_layers()
+    return EXIT_SUCCESS;
+}
+
+
+/* Shared data files
+* Layers that read the same file directly (without --load) would each have
+* gnuplot open and parse it again. Each file used by more than one layer is
+* sent to gnuplot once instead, as a datablock ($FILE1, $FILE2, ...) holding the
+* file's text unchanged, and those layers' plot clauses are pointed at it.
+*/
+struct SharedFile {
+    std::string path;
+    std::string name;
+    std::unique_ptr<MappedFile> file;
+};
+
+// whether a line of text starts with eod, which would end a datablock
+// "<< eod" early (and have gnuplot run the rest of the text as commands)
+bool ends_datablock(std::string_view text, const std::string& eod) {
+    return text.substr(0, eod.size()) == eod || text.find("\n" + eod) != std::string_view::npos;
+}
+
+std::vector<SharedFile> share_data_files(LayerList& layers) {
+    std::vector<SharedFile> shared;
+    std::unordered_map<std::string, size_t> n_readers;
+    for (Layer& layer : layers) {
+        if (layer.get_data_file() != "") {
+            n_readers[layer.get_data_file()]++;
+        }
+    }
+    for (Layer& layer : layers) {
+        std::string path = layer.get_data_file();
+        if (path == "" || n_readers[path] < 2) {
+            continue;
+        }
+        auto it = std::find_if(shared.begin(), shared.end(),
+                               [&path](const SharedFile& sf) { return sf.path == path; });
+        if (it == shared.end()) {
+            std::unique_ptr<MappedFile> file(new MappedFile());
+            if (!file->open(path)) {
+                n_readers[path] = 0; // leave it to gnuplot to report
+                continue;
+            }
+            if (ends_datablock(file->text(), "EOD")) {
+                n_readers[path] = 0; // it can't be sent as is, so each layer reads it
+                continue;
+            }
+            std::string name = "$FILE" + std::to_string(shared.size() + 1);
+            shared.push_back(SharedFile{path, name, std::move(file)});
+            it = shared.end() - 1;
+        }
+        layer.set_source(it->name);
+    }
+    return shared;
+}
+
+void write_shared_file(const SharedFile& sf, PipeWriter& out) {
+    std::string_view text = sf.file->text();
+    out.write(sf.name + " << EOD\n");
+    out.write(text);
+    if (!text.empty() && text.back() != '\n') {
+        out.put('\n');
+    }
+    out.write("EOD\n");
+}
+
+
+/* Facets
+* A facet layer (--facet -x col, or -y col -x col for a grid) draws the plot
+* once per panel, one panel per value of the key column(s), in a gnuplot
+* multiplot. Each data file the layers read is partitioned by its key in one
+* pass over its rows: newline-aligned chunks are split in parallel into runs of
+* adjacent rows per key, and then the runs of each key are joined in file order.
+* The runs point into the mapped file, so each panel's datablock ($PANEL1_1,
+* ...) is written from the file's text unchanged, and every layer's plot clause
+* is reused for each panel, reading that panel's datablock.
+* Layers whose data doesn't come unchanged from a file (inline, stats,
+* downsampled) are drawn whole in every panel.
+*/
+struct FacetFile {
+    std::string path;
+    std::unique_ptr<MappedFile> file;
+    std::string_view header; // lines before the first row
+    std::vector<std::vector<std::string_view>> runs; // rows of each panel, in file order
+    std::string eod = "EOD"; // the terminator of its panels' datablocks, a line of the file never starts with
+};
+
+struct Facets {
+    size_t n_rows = 0, n_cols = 0;
+    std::vector<std::string> titles; // of each panel
+    std::vector<FacetFile> files;
+    std::vector<Text> plot_lines;    // of each panel, "" for an empty cell of a grid
+    bool enabled() const { return n_cols > 0; }
+    static std::string block(size_t f, size_t p) {
+        return "$PANEL" + std::to_string(f + 1) + "_" + std::to_string(p + 1);
+    }
+};
+
+// the rows of one chunk of a file, split by key
+struct FacetPart {
+    std::unordered_map<std::string, size_t> slots; // key -> index into keys, runs
+    std::vector<std::string> keys;
+    std::vector<std::vector<std::string_view>> runs;
+};
+
+// the grid's row and column values are joined into one key
+const char facet_key_sep = '\x1f';
+
+void partition_chunk(std::string_view chunk, char delim, const std::vector<size_t>& key_cols,
+                     FacetPart& part) {
+    std::vector<std::string_view> fields;
+    std::string key, last_key;
+    size_t last_slot = SIZE_MAX;
+    size_t pos = 0;
+    while (pos < chunk.size()) {
+        size_t start = pos;
+        std::string_view line = next_line(chunk, pos);
+        if (skip_line(line))
+            continue;
+        split_fields(line, delim, fields);
+        key.clear();
+        for (size_t i = 0; i < key_cols.size(); i++) {
+            if (i > 0)
+                key += facet_key_sep;
+            if (key_cols[i] < fields.size())
+                key += unquote(fields[key_cols[i]]);
+        }
+        // rows with the same key as the last one (as in sorted or grouped
+        // files) don't need a lookup
+        if (last_slot == SIZE_MAX || key != last_key) {
+            auto it = part.slots.emplace(key, part.keys.size()).first;
+            if (it->second == part.keys.size()) {
+                part.keys.push_back(key);
+                part.runs.emplace_back();
+            }
+            last_key = key;
+            last_slot = it->second;
+        }
+        std::string_view row = chunk.substr(start, std::min(pos, chunk.size()) - start);
+        std::vector<std::string_view>& runs = part.runs[last_slot];
+        if (!runs.empty() && runs.back().data() + runs.back().size() == row.data()) {
+            runs.back() = std::string_view(runs.back().data(), runs.back().size() + row.size());
+        } else {
+            runs.push_back(row);
+        }
+    }
+}
+
+// the index of a column given by name or (1-based) number, or SIZE_MAX
+size_t find_column(const DataFrame& df, const std::string& col) {
+    if (!col.empty() && col.find_first_not_of("0123456789") == std::string::npos) {
+        size_t j = 0;
+        bool in_range = std::from_chars(col.data(), col.data() + col.size(), j).ec == std::errc();
+        return (in_range && j >= 1 && j <= df.ncol()) ? j - 1 : SIZE_MAX;
+    }
+    for (size_t j = 0; j < df.ncol(); j++) {
+        if (df.name(j) == col)
+            return j;
+    }
+    return SIZE_MAX;
+}
+
+// split a file into the rows of each key. False if it can't be read or doesn't
+// have the key columns.
+bool partition_file(FacetFile& ff, char delim, const std::vector<std::string>& key_names,
+                    ThreadPool& pool, std::vector<FacetPart>& parts) {
+    ff.file.reset(new MappedFile());
+    if (!ff.file->open(ff.path)) {
+        return false;
+    }
+    std::string_view text = ff.file->text();
+    while (ends_datablock(text, ff.eod)) {
+        ff.eod += '_';
+    }
+    DataFrame df;
+    size_t pos = 0;
+    parse_header(text, pos, delim, df);
+    std::vector<size_t> key_cols;
+    for (const std::string& name : key_names) {
+        key_cols.push_back(find_column(df, name));
+        if (key_cols.back() == SIZE_MAX) {
+            std::cerr << "Warning: no facet column '" << name << "' in '" << ff.path
+                      << "', its layers are drawn in every panel\n";
+            return false;
+        }
+    }
+    pos = std::min(pos, text.size());
+    ff.header = text.substr(0, pos);
+    std::vector<std::string_view> chunks = line_chunks(text.substr(pos), &pool);
+    parts.assign(chunks.size(), FacetPart());
+    pool.parallel_for(chunks.size(), [&](size_t k) {
+        partition_chunk(chunks[k], delim, key_cols, parts[k]);
+    });
+    return true;
+}
+
+// sort the distinct values of a facet, by value if they are all numbers
+void sort_facet_values(std::vector<std::string>& values) {
+    std::sort(values.begin(), values.end());
+    values.erase(std::unique(values.begin(), values.end()), values.end());
+    double value;
+    bool numeric = std::all_of(values.begin(), values.end(),
+                               [&value](const std::string& v) { return parse_double(v, value); });
+    if (numeric) {
+        std::stable_sort(values.begin(), values.end(), [](const std::string& a, const std::string& b) {
+            double va = 0, vb = 0;
+            parse_double(a, va);
+            parse_double(b, vb);
+            return va < vb;
+        });
+    }
+}
+
+
+/* Plot
+* One composed plot spec: the layers, the states and data they were composed
+* with, and the resulting set and plot lines. Layers keep references into it,
+* so it is never copied or moved.
+*/
+struct Plot {
+    Arena arena; // first, so it outlives everything allocated from it
+    Environment global{arena.resource()}, local{arena.resource()};
+    std::deque<Environment> layer_locals; // each layer's copy of local, see keep_local()
+    DataStore data;
+    LayerList layers;
+    std::vector<SharedFile> shared_files;
+    Facets facets;
+    Text set_lines{arena.resource()}, plot_lines{"plot ", arena.resource()};
+    std::string output = "", terminal = ""; // render to a file instead of a window
+    bool stdin_used = false;
+
+    Plot() = default;
+    Plot(const Plot&) = delete;
+    Plot& operator=(const Plot&) = delete;
+
+    // a copy of the local state for the layer it was parsed for, kept until
+    // its data is prepared (local itself is cleared for the next layer)
+    Environment& keep_local() {
+        return layer_locals.emplace_back(local, arena.resource());
+    }
+};
+
+/* Layer data
+* Once every layer is composed (in order, as each may update the global state),
+* their data - inline columns, loaded files, and what is derived or computed
+* from them - is prepared at once on the thread pool: a layer's data only
+* depends on its own state and the files it reads, which the data store loads
+* once. Idle threads take the next layer (or help with a load or transform
+* running in another), so a slow layer doesn't hold up the others. The plot
+* commands are then finished in layer order, so the script is the same as if
+* the layers had been prepared one by one. False if a layer's data couldn't be
+* prepared (a plot clause without it could leave gnuplot waiting for data).
+*/
+bool prepare_layers(Plot& plot) {
+    ThreadPool& pool = plot.data.thread_pool(static_cast<size_t>(plot.global.number(Key::threads)));
+    {
+        StageTimer timer("prepare data");
+        size_t parent = StageTimer::current(); // (the tasks run on other threads too)
+        plot.arena.set_shared(true); // layers allocate Text from the pool's threads
+        pool.parallel_for(plot.layers.size(), [&plot, parent](size_t i) {
+            StageTimer layer_timer("data", plot.layers.name(i), parent);
+            plot.layers[i].prepare_data();
+        });
+        plot.arena.set_shared(false);
+    }
+    for (Layer& layer : plot.layers) {
+        if (!layer.ok()) {
+            return false;
+        }
+    }
+    for (Layer& layer : plot.layers) {
+        layer.finish();
+    }
+    return true;
+}
+
+// options that choose how plots are run, rather than what is plotted
+struct RunOptions {
+    std::string server_path = "", client_path = "", batch_path = "";
+    std::string script_cache = ""; // --script_cache dir (see find_cache_spec())
+    size_t n_workers = 2; // --server
+    size_t n_cache_entries = 64; // plots a --server caches, 0 for none
+    size_t max_connections = 64; // --server, served at once
+    int render_timeout_ms = 60000; // --server, most time a connection (and its render) may take
+    size_t n_jobs = 0;    // --batch, 0 for one per core
+    bool quiet = false;   // --quiet: nothing on stdout, and no waiting on stdin
+    std::string script_path = ""; // --script: write the script there instead of running gnuplot
+    bool watch = false;
+    int watch_interval = 500; // --watch, least ms between updates
+    double fps = 10;          // --live
+};
+
+
+// split the layers of a faceted plot into its panels (see Facets): partition
+// each file they read, point their plot clauses at the first panel's
+// datablocks, and make the plot command of every panel
+bool facet_plot(Plot& plot) {
+    Facets& facets = plot.facets;
+    std::string facet_x(plot.global.get(Key::facet_x)), facet_y(plot.global.get(Key::facet_y));
+    if (facet_x == "" && facet_y == "") {
+        return true;
+    }
+    std::vector<std::string> key_names;
+    for (const std::string& name : {facet_y, facet_x}) {
+        if (name != "")
+            key_names.push_back(name);
+    }
+    const bool grid = (facet_y != "");
+    char delim = delim_char(plot.global.get(Key::file_delim, " "));
+    ThreadPool& pool = plot.data.thread_pool(static_cast<size_t>(plot.global.number(Key::threads)));
+
+    // the file each layer reads, if it is split into panels
+    std::vector<size_t> layer_file;
+    std::vector<std::vector<FacetPart>> parts;
+    std::vector<std::string> unsplit;
+    for (Layer& layer : plot.layers) {
+        if (layer.reads_stream() || layer.get_live() != nullptr) {
+            std::cerr << "Error: --facet can't split --stream or --live data\n";
+            return false;
+        }
+        std::string path = layer.get_data_file();
+        if (path == "") {
+            for (const auto& ds : plot.data.get_datasets()) {
+                if (ds->path != "" && ds->name == layer.get_source())
+                    path = ds->path;
+            }
+        }
+        if (is_multi_source(path)) {
+            std::cerr << "Error: --facet can't split a multi-file source\n";
+            return false;
+        }
+        size_t f = SIZE_MAX;
+        if (path != "" && std::find(unsplit.begin(), unsplit.end(), path) == unsplit.end()) {
+            for (f = 0; f < facets.files.size() && facets.files[f].path != path; f++) {}
+            if (f == facets.files.size()) {
+                FacetFile ff;
+                ff.path = path;
+                std::vector<FacetPart> file_parts;
+                if (partition_file(ff, delim, key_names, pool, file_parts)) {
+                    facets.files.push_back(std::move(ff));
+                    parts.push_back(std::move(file_parts));
+                } else {
+                    unsplit.push_back(path);
+                    f = SIZE_MAX;
+                }
+            }
+        }
+        layer_file.push_back(f);
+    }
+    if (facets.files.empty()) {
+        std::cerr << "Warning: no data file to facet, drawing one panel\n";
+        return true;
+    }
+
+    // the panels: every value of the key (a wrap), or every combination of the
+    // row and column values (a grid)
+    std::vector<std::string> keys, row_values, col_values;
+    for (const auto& file_parts : parts) {
+        for (const FacetPart& part : file_parts) {
+            for (const std::string& key : part.keys) {
+                if (grid && facet_x != "") {
+                    size_t sep = key.find(facet_key_sep);
+                    row_values.push_back(key.substr(0, sep));
+                    col_values.push_back(key.substr(sep + 1));
+                } else if (grid) {
+                    row_values.push_back(key);
+                } else {
+                    col_values.push_back(key);
+                }
+            }
+        }
+    }
+    sort_facet_values(row_values);
+    sort_facet_values(col_values);
+    if (grid) {
+        facets.n_rows = row_values.size();
+        facets.n_cols = std::max<size_t>(1, col_values.size());
+        for (const std::string& row : row_values) {
+            if (facet_x == "") {
+                keys.push_back(row);
+                facets.titles.push_back(row);
+                continue;
+            }
+            for (const std::string& col : col_values) {
+                keys.push_back(row + facet_key_sep + col);
+                facets.titles.push_back(row + ", " + col);
+            }
+        }
+    } else {
+        keys = col_values;
+        facets.titles = col_values;
+        size_t ncol = static_cast<size_t>(plot.global.number(Key::ncol));
+        facets.n_cols = (ncol > 0) ? std::min(ncol, keys.size())
+                                   : static_cast<size_t>(std::ceil(std::sqrt(static_cast<double>(keys.size()))));
+        facets.n_cols = std::max<size_t>(1, facets.n_cols);
+        facets.n_rows = (keys.size() + facets.n_cols - 1) / facets.n_cols;
+    }
+
+    // join the runs of each panel's rows, in chunk (file) order
+    for (size_t f = 0; f < facets.files.size(); f++) {
+        FacetFile& ff = facets.files[f];
+        ff.runs.assign(keys.size(), {});
+        pool.parallel_for(keys.size(), [&](size_t p) {
+            for (const FacetPart& part : parts[f]) {
+                auto it = part.slots.find(keys[p]);
+                if (it == part.slots.end())
+                    continue;
+                for (std::string_view run : part.runs[it->second]) {
+                    std::vector<std::string_view>& runs = ff.runs[p];
+                    if (!runs.empty() && runs.back().data() + runs.back().size() == run.data()) {
+                        runs.back() = std::string_view(runs.back().data(), runs.back().size() + run.size());
+                    } else {
+                        runs.push_back(run);
+                    }
+                }
+            }
+        });
+    }
+
+    // each panel plots the split layers from its datablocks, and the others whole
+    for (size_t p = 0; p < keys.size(); p++) {
+        Text line = "";
+        size_t i = 0;
+        for (Layer& layer : plot.layers) {
+            size_t f = layer_file[i++];
+            Text clause = (f == SIZE_MAX) ? layer.get_plot_line()
+                                          : (facets.files[f].runs[p].empty() ? Text("")
+                                             : layer.get_plot_line(Facets::block(f, p)));
+            if (clause != "") {
+                line += clause + ",";
+            }
+        }
+        facets.plot_lines.push_back(line == "" ? line : "plot " + line);
+    }
+    size_t i = 0;
+    for (Layer& layer : plot.layers) {
+        size_t f = layer_file[i++];
+        if (f != SIZE_MAX) {
+            layer.set_source(Facets::block(f, 0));
         }
-        void _set_setters() override {
-            std::string leg;
-            if (global["legend_position"] == "none") {
-                leg = "off";
-            } else if (global["legend_position"] == "right" ||
-                       global["legend_position"] == "left") {
-                leg = "outside " + global["legend_position"] + " center " +
-                      global["legend_direction"];
-            } else if (global["legend_position"] == "top" ||
-                       global["legend_position"] == "bottom") {
-                leg = "outside center " + global["legend_position"] + " " +
-                      global["legend_direction"];
-            } else {
-                std::cerr << "Error: invalid legend position '" <<
-                                   global["legend_position"] << "', ignoring\n";
-                leg = "off";
+    }
+    // the loaded files are sent as panels instead, unless a layer draws one whole
+    for (const auto& ds : plot.data.get_datasets()) {
+        if (ds->path == "")
+            continue;
+        ds->referenced = false;
+        for (Layer& layer : plot.layers) {
+            ds->referenced = ds->referenced || layer.get_source() == ds->name;
+        }
+    }
+    return true;
+}
+
+// write what comes before the plot command: shared data and set commands
+void write_preamble(PipeWriter& out, Plot& plot) {
+    plot.data.write_datablocks(out, delim_char(plot.global.get(Key::file_delim, " ")));
+    for (const auto& sf : plot.shared_files) {
+        write_shared_file(sf, out);
+    }
+    for (size_t f = 0; f < plot.facets.files.size(); f++) {
+        const FacetFile& ff = plot.facets.files[f];
+        for (size_t p = 0; p < ff.runs.size(); p++) {
+            if (ff.runs[p].empty())
+                continue;
+            out.write(Facets::block(f, p) + " << " + ff.eod + "\n");
+            out.write(ff.header);
+            for (std::string_view run : ff.runs[p]) {
+                out.write(run);
             }
-            set_command += "set key " + leg + "\n";
+            if (ff.runs[p].back().back() != '\n') {
+                out.put('\n');
+            }
+            out.write(ff.eod + "\n");
         }
-        void _set_plotcmd() override {
+    }
+    out.write(plot.set_lines);
+    out.put('\n');
+}
+
+// a string as a gnuplot single-quoted string
+std::string quoted(std::string_view str) {
+    std::string result = "'";
+    for (char c : str) {
+        result += c;
+        if (c == '\'')
+            result += c;
+    }
+    return result + "'";
+}
+
+void write_panels(PipeWriter& out, Plot& plot) {
+    const Facets& facets = plot.facets;
+    std::string_view title = plot.global.get(Key::title);
+    out.write("set multiplot layout " + std::to_string(facets.n_rows) + "," + std::to_string(facets.n_cols)
+              + (title != "" ? " title " + quoted(title) : "") + "\n");
+    for (size_t p = 0; p < facets.plot_lines.size(); p++) {
+        if (facets.plot_lines[p] == "") {
+            out.write("set multiplot next\n");
+            continue;
+        }
+        out.write("set title " + quoted(facets.titles[p]) + "\n");
+        out.write(facets.plot_lines[p]);
+        out.put('\n');
+        for (Layer& layer : plot.layers) {
+            layer.write_inline_data(out);
+        }
+        out.flush();
+    }
+    out.write("unset multiplot\n");
+    out.flush();
+}
+
+// write a composed plot as a gnuplot script: shared data, set commands, the
+// plot command, and then each layer's inline data in plot-clause order
+// (or, faceted, a multiplot of the plot command of each panel, which all read
+// the layers' inline data again)
+void write_script(PipeWriter& out, Plot& plot) {
+    write_preamble(out, plot);
+    if (plot.facets.enabled()) {
+        write_panels(out, plot);
+        return;
+    }
+    out.write(plot.plot_lines);
+    out.put('\n');
+    out.flush(); // gnuplot can start on the commands while the data is generated
+    for (Layer& layer : plot.layers) {
+        layer.write_inline_data(out);
+    }
+    out.flush();
+}
+
+// write the script to a file, a file descriptor ("fd:3") or stdout ("-"),
+// false on an error
+bool write_script_to(const std::string& target, Plot& plot) {
+    bool is_fd = target.compare(0, 3, "fd:") == 0;
+    int fd = (target == "-") ? STDOUT_FILENO
+           : is_fd ? std::atoi(target.c_str() + 3)
+           : ::open(target.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        std::cerr << "Error: could not open script '" << target << "': " << std::strerror(errno) << "\n";
+        return false;
+    }
+    std::cout << std::flush; // (anything already printed goes first)
+    bool ok;
+    {
+        PipeWriter out(fd);
+        write_script(out, plot);
+        ok = out.finish();
+    }
+    if (target != "-" && !is_fd) {
+        ok = (close(fd) == 0) && ok;
+    }
+    if (!ok) {
+        std::cerr << "Error: writing script to '" << target << "': " << std::strerror(errno) << "\n";
+    }
+    return ok;
+}
+
+std::string script_to_string(Plot& plot) {
+    std::string result = "";
+    PipeWriter out(result);
+    write_script(out, plot);
+    return result;
+}
+
+
+/* Watch mode
+* With --watch, the plot stays open and follows its data files like tail -f.
+* Rows appended to a file that was sent as a datablock ($DATA, $FILE1) are
+* appended to that datablock with "set print ... append", files gnuplot reads
+* itself are simply read again, and then the plot is redrawn with replot.
+* Files are checked (and the plot redrawn) at most once per interval, so rows
+* written faster than that are sent together and gnuplot isn't swamped.
+*/
+struct WatchedFile {
+    std::string path;
+    std::string block;  // datablock holding the file's rows, "" if gnuplot reads the file
+    size_t offset = 0;  // bytes sent (or read by gnuplot) so far
+    const Dataset* dataset = nullptr; // the file loaded into the block, if it's a --load one
+};
+
+std::vector<WatchedFile> watched_files(Plot& plot) {
+    std::vector<WatchedFile> files;
+    auto add = [&files](const std::string& path, const std::string& block, size_t offset,
+                        const Dataset* dataset = nullptr) {
+        for (const auto& wf : files) {
+            if (wf.path == path && wf.block == block)
+                return;
+        }
+        files.push_back(WatchedFile{path, block, offset, dataset});
+    };
+    for (const auto& ds : plot.data.get_datasets()) {
+        if (ds->referenced && ds->path != "") {
+            add(ds->path, ds->name, ds->n_bytes, ds.get());
+        }
+    }
+    for (const auto& sf : plot.shared_files) {
+        add(sf.path, sf.name, sf.file->text().size());
+    }
+    for (Layer& layer : plot.layers) {
+        struct stat st;
+        std::string path = layer.get_data_file();
+        if (path != "" && stat(path.c_str(), &st) == 0) {
+            add(path, "", st.st_size);
+        }
+    }
+    return files;
+}
+
+// append a line of data to a datablock (print takes a single-quoted string,
+// where a quote is doubled)
+void print_to_block(std::string_view line, PipeWriter& out) {
+    out.write("print '");
+    size_t quote;
+    while ((quote = line.find('\'')) != std::string_view::npos) {
+        out.write(line.substr(0, quote + 1));
+        out.put('\'');
+        line.remove_prefix(quote + 1);
+    }
+    out.write(line);
+    out.write("'\n");
+}
+
+// complete lines appended to a loaded file as they are in its datablock: parsed
+// into its columns, filtered (--xlim) and formatted with delim, as the file was
+// when it was loaded (from the start of the file, its header is skipped and the
+// names line written again)
+std::string loaded_rows(const Dataset& ds, std::string_view text, bool from_start, char delim) {
+    size_t pos = 0;
+    DataFrame rows;
+    std::string result;
+    PipeWriter writer(result);
+    if (from_start) {
+        DataFrame header;
+        parse_header(text, pos, ds.delim, header);
+        ds.frame.write_names(writer, delim);
+    }
+    std::vector<std::vector<double>> columns(ds.frame.ncol());
+    parse_rows(text.substr(std::min(pos, text.size())), ds.delim, columns);
+    for (size_t j = 0; j < columns.size(); j++) {
+        rows.add_column(ds.frame.name(j), std::move(columns[j]));
+    }
+    filter_rows(rows, ds.filter);
+    rows.write_text(writer, delim);
+    return result;
+}
+
+// send the complete lines appended to the file since its offset, returning
+// false if nothing changed. The rows of a loaded file are sent as it was
+// loaded (see loaded_rows()), with delim.
+bool follow_file(WatchedFile& wf, PipeWriter& out, char delim) {
+    struct stat st;
+    if (stat(wf.path.c_str(), &st) != 0) {
+        return false;
+    }
+    size_t size = st.st_size;
+    bool rewrite = false;
+    if (size < wf.offset) {
+        std::cerr << "Warning: '" << wf.path << "' was truncated, following it from the start\n";
+        wf.offset = 0;
+        rewrite = true;
+    }
+    if (size == wf.offset && !rewrite) {
+        return false;
+    }
+    if (wf.block == "") {
+        wf.offset = size; // gnuplot reads the file again on replot
+        return true;
+    }
+    int fd = open(wf.path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    std::string buffer;
+    char chunk[stream_chunk_size];
+    ssize_t n;
+    bool sent = false;
+    while (wf.offset + buffer.size() < size
+           && (n = pread(fd, chunk, sizeof(chunk), wf.offset + buffer.size())) > 0) {
+        buffer.append(chunk, n);
+        std::string_view text = buffer;
+        size_t end = text.rfind('\n');
+        if (end == std::string_view::npos)
+            continue;
+        if (!sent) {
+            out.write("set print " + wf.block + (rewrite ? "\n" : " append\n"));
+            sent = true;
+        }
+        size_t pos = 0;
+        text = text.substr(0, end + 1);
+        std::string rows;
+        if (wf.dataset != nullptr) {
+            rows = loaded_rows(*wf.dataset, text, wf.offset == 0, delim);
+            text = rows;
+        }
+        while (pos < text.size()) {
+            print_to_block(next_line(text, pos), out);
+        }
+        wf.offset += end + 1;
+        buffer.erase(0, end + 1);
+    }
+    // (a partial last line is left for the next update)
+    close(fd);
+    if (sent) {
+        out.write("unset print\n");
+    }
+    return sent;
+}
+
+// follow the plot's data files until there's input on input_fd (enter), or
+// for good if it's -1
+void watch_plot(Plot& plot, int gnuplot_fd, int input_fd, int interval_ms) {
+    for (Layer& layer : plot.layers) {
+        if (layer.has_computed_data()) {
+            std::cerr << "Warning: computed layers (stats, downsampling) aren't updated by --watch\n";
+            break;
+        }
+    }
+    std::vector<WatchedFile> files = watched_files(plot);
+    char delim = delim_char(plot.global.get(Key::file_delim, " "));
+    while (true) {
+        struct pollfd input = {input_fd, POLLIN, 0};
+        int ready = poll(&input, 1, std::max(1, interval_ms));
+        if (ready > 0 || (ready < 0 && errno != EINTR)) {
             return;
         }
+        PipeWriter out(gnuplot_fd);
+        bool changed = false;
+        for (auto& wf : files) {
+            changed = follow_file(wf, out, delim) || changed;
+        }
+        if (changed) {
+            // replot reads the layers' inline data again
+            out.write("replot\n");
+            for (Layer& layer : plot.layers) {
+                layer.write_inline_data(out);
+            }
+        }
+        out.finish();
+    }
+}
+
+
+// read the lines of a live stream and push them to the queue as samples, until
+// the stream ends or stop is set
+void read_live(const std::string& src, char delim, SpscQueue<LiveSample>& queue,
+               const std::atomic<bool>& stop) {
+    int fd = (src == "-") ? STDIN_FILENO : open(src.c_str(), O_RDONLY);
+    if (fd < 0) {
+        std::cerr << "Error: could not open stream '" << src << "': "
+                  << std::strerror(errno) << "\n";
+        return;
+    }
+    std::vector<char> chunk(stream_chunk_size);
+    std::string pending;
+    std::vector<std::string_view> fields;
+    LiveSample sample;
+    ssize_t n;
+    while (!stop && (n = read(fd, chunk.data(), chunk.size())) != 0) {
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            std::cerr << "Error: reading stream '" << src << "': " << std::strerror(errno) << "\n";
+            break;
+        }
+        pending.append(chunk.data(), n);
+        size_t end = pending.rfind('\n');
+        if (end == std::string::npos)
+            continue;
+        std::string_view text(pending.data(), end + 1);
+        size_t pos = 0;
+        while (pos < text.size()) {
+            std::string_view line = next_line(text, pos);
+            if (skip_line(line))
+                continue;
+            split_fields(line, delim, fields);
+            sample.n_fields = std::min(fields.size(), max_live_fields);
+            for (size_t j = 0; j < sample.n_fields; j++) {
+                if (!parse_double(fields[j], sample.fields[j])) {
+                    sample.fields[j] = std::numeric_limits<double>::quiet_NaN();
+                }
+            }
+            // the render loop drains the queue every frame, so it is only full
+            // if gnuplot falls behind - wait for it rather than drop samples
+            while (!queue.push(sample) && !stop) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+            sample.number++;
+        }
+        pending.erase(0, end + 1);
+    }
+    if (fd != STDIN_FILENO) {
+        close(fd);
+    }
+}
+
+// plot the live layers' windows at up to fps frames per second, until all of
+// their streams have ended
+int run_live(Plot& plot, int gnuplot_fd, double fps) {
+    struct Source {
+        std::string path;
+        std::unique_ptr<SpscQueue<LiveSample>> queue;
+        std::thread reader;
+        std::atomic<bool> done{false};
+    };
+    struct Series {
+        const LiveSpec* spec;
+        Source* source;
+        RingBuffer<std::pair<double, double>> window;
+    };
+    std::vector<std::unique_ptr<Source>> sources;
+    std::vector<std::unique_ptr<Series>> series(plot.layers.size());
+    std::atomic<bool> stop{false};
+    for (size_t i = 0; i < plot.layers.size(); i++) {
+        const LiveSpec* spec = plot.layers[i].get_live();
+        if (spec == nullptr) {
+            if (plot.layers[i].reads_stream()) {
+                std::cerr << "Error: --stream layers must all be --live in live mode\n";
+                return EXIT_FAILURE;
+            }
+            continue;
+        }
+        auto it = std::find_if(sources.begin(), sources.end(),
+                               [spec](const std::unique_ptr<Source>& src) { return src->path == spec->source; });
+        if (it == sources.end()) {
+            sources.emplace_back(new Source());
+            sources.back()->path = spec->source;
+            sources.back()->queue.reset(new SpscQueue<LiveSample>(4096));
+            it = sources.end() - 1;
+        }
+        series[i].reset(new Series{spec, it->get(), RingBuffer<std::pair<double, double>>(spec->window)});
+    }
+    for (auto& src : sources) {
+        Source* s = src.get();
+        char delim = ' ';
+        for (const auto& ser : series) {
+            if (ser && ser->source == s)
+                delim = ser->spec->delim;
+        }
+        s->reader = std::thread([s, delim, &stop]() {
+            read_live(s->path, delim, *s->queue, stop);
+            s->done = true;
+        });
+    }
+
+    {
+        PipeWriter out(gnuplot_fd);
+        write_preamble(out, plot);
+        out.finish();
+    }
+    auto period = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+        std::chrono::duration<double>(1 / std::max(0.1, fps)));
+    auto next_frame = std::chrono::steady_clock::now();
+    bool running = true;
+    char buf[32];
+    while (running) {
+        next_frame += period;
+        std::this_thread::sleep_until(next_frame);
+        // (checked before draining, so no samples are pushed after the last frame)
+        running = false;
+        for (const auto& src : sources) {
+            running = running || !src->done;
+        }
+        bool changed = false;
+        LiveSample sample;
+        for (const auto& src : sources) {
+            while (src->queue->pop(sample)) {
+                changed = true;
+                for (const auto& ser : series) {
+                    if (!ser || ser->source != src.get())
+                        continue;
+                    const LiveSpec& spec = *ser->spec;
+                    auto field = [&sample](size_t col) {
+                        return (col >= 1 && col <= sample.n_fields) ? sample.fields[col - 1]
+                                                                    : std::numeric_limits<double>::quiet_NaN();
+                    };
+                    double x = (spec.x_col == 0) ? static_cast<double>(sample.number) : field(spec.x_col);
+                    double y = field(spec.y_col);
+                    if (!std::isnan(x) && !std::isnan(y)) {
+                        ser->window.push({x, y});
+                    }
+                }
+            }
+        }
+        if (!changed)
+            continue;
+        PipeWriter out(gnuplot_fd);
+        out.write(plot.plot_lines);
+        out.put('\n');
+        for (size_t i = 0; i < plot.layers.size(); i++) {
+            if (!series[i]) {
+                plot.layers[i].write_inline_data(out);
+                continue;
+            }
+            const auto& window = series[i]->window;
+            for (size_t j = 0; j < window.size(); j++) {
+                out.write(buf, format_double(window[j].first, buf));
+                out.put(' ');
+                out.write(buf, format_double(window[j].second, buf));
+                out.put('\n');
+            }
+            out.write("e\n");
+        }
+        out.finish();
+    }
+    stop = true;
+    for (auto& src : sources) {
+        src->reader.join();
+    }
+    return EXIT_SUCCESS;
+}
+
+
+/* GnuplotProcess
+* A gnuplot child process, with pipes to its stdin (for commands) and stdout.
+* sync() waits until gnuplot has finished everything sent so far, by having it
+* print a sentinel line back to us - for at most a given time, as a script can
+* leave gnuplot waiting (e.g., on "pause -1", or for the data of a '-' clause).
+*/
+class GnuplotProcess {
+    private:
+        pid_t pid = -1;
+        int in_fd = -1;
+        int out_fd = -1;
+        std::string out_buffer;
+        size_t n_syncs = 0;
+        // false if gnuplot exited, or there's no line by the deadline (if any)
+        bool _read_line(std::string& line, const std::chrono::steady_clock::time_point* deadline) {
+            char chunk[4096];
+            size_t nl;
+            while ((nl = out_buffer.find('\n')) == std::string::npos) {
+                if (deadline != nullptr) {
+                    auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+                        *deadline - std::chrono::steady_clock::now()).count();
+                    pollfd pfd = {out_fd, POLLIN, 0};
+                    int ready = (left > 0) ? poll(&pfd, 1, static_cast<int>(left)) : 0;
+                    if (ready < 0 && errno == EINTR)
+                        continue;
+                    if (ready <= 0)
+                        return false;
+                }
+                ssize_t n = read(out_fd, chunk, sizeof(chunk));
+                if (n < 0 && errno == EINTR)
+                    continue;
+                if (n <= 0)
+                    return false;
+                out_buffer.append(chunk, n);
+            }
+            line = out_buffer.substr(0, nl);
+            out_buffer.erase(0, nl + 1);
+            return true;
+        }
+    public:
+        GnuplotProcess() = default;
+        GnuplotProcess(const GnuplotProcess&) = delete;
+        GnuplotProcess& operator=(const GnuplotProcess&) = delete;
+        ~GnuplotProcess() { stop(); }
+
+        bool start() {
+            int in_pipe[2], out_pipe[2];
+            if (pipe(in_pipe) != 0) {
+                return false;
+            }
+            if (pipe(out_pipe) != 0) {
+                close(in_pipe[0]);
+                close(in_pipe[1]);
+                return false;
+            }
+            pid = fork();
+            if (pid < 0) {
+                std::cerr << "Error: could not start gnuplot: " << std::strerror(errno) << "\n";
+                return false;
+            }
+            if (pid == 0) {
+                dup2(in_pipe[0], STDIN_FILENO);
+                dup2(out_pipe[1], STDOUT_FILENO);
+                close(in_pipe[0]);
+                close(in_pipe[1]);
+                close(out_pipe[0]);
+                close(out_pipe[1]);
+                execlp("gnuplot", "gnuplot", (char*) nullptr);
+                _exit(127);
+            }
+            close(in_pipe[0]);
+            close(out_pipe[1]);
+            fcntl(in_pipe[1], F_SETFD, FD_CLOEXEC); // not inherited by later children
+            fcntl(out_pipe[0], F_SETFD, FD_CLOEXEC);
+            // (so writes can time out when gnuplot stops reading, see write_all())
+            fcntl(in_pipe[1], F_SETFL, fcntl(in_pipe[1], F_GETFL) | O_NONBLOCK);
+            in_fd = in_pipe[1];
+            out_fd = out_pipe[0];
+            return true;
+        }
+        void stop() {
+            if (in_fd >= 0) {
+                close(in_fd); // gnuplot exits at the end of its input
+                in_fd = -1;
+            }
+            if (out_fd >= 0) {
+                close(out_fd);
+                out_fd = -1;
+            }
+            if (pid > 0) {
+                waitpid(pid, nullptr, 0);
+                pid = -1;
+            }
+            out_buffer.clear();
+        }
+        // stop gnuplot even if it isn't reading its input
+        void kill() {
+            if (pid > 0) {
+                ::kill(pid, SIGKILL);
+            }
+            stop();
+        }
+        bool running() const { return in_fd >= 0; }
+        // the pipe to gnuplot's stdin (non-blocking)
+        int input() { return in_fd; }
+        // wait for gnuplot to work through its input (for at most timeout_ms, if
+        // it's >= 0), false if it has exited or timed out. With error, also
+        // fetches the last error gnuplot reported since a "reset errors" ("" if
+        // there was none).
+        bool sync(int timeout_ms = -1, std::string* error = nullptr) {
+            std::string sentinel = "__gg_sync_" + std::to_string(++n_syncs) + "__";
+            std::string error_tag = sentinel + "error ";
+            std::string cmd = "set print '-'\n";
+            if (error != nullptr) {
+                error->clear();
+                cmd += "if (GPVAL_ERRNO != 0) print '" + error_tag + "' . GPVAL_ERRMSG\n";
+            }
+            cmd += "print '" + sentinel + "'\nset print\n";
+            auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+            if (!write_all(in_fd, cmd.data(), cmd.size(), timeout_ms >= 0 ? &deadline : nullptr)) {
+                return false;
+            }
+            std::string line;
+            while (_read_line(line, timeout_ms >= 0 ? &deadline : nullptr)) {
+                if (line == sentinel) {
+                    return true;
+                }
+                if (error != nullptr && line.compare(0, error_tag.size(), error_tag) == 0) {
+                    *error = line.substr(error_tag.size());
+                }
+            }
+            return false;
+        }
 };
 
 
-// Point layer
-class PointLayer : public Layer {
-    protected:
-        std::string d_x_data = "1";
-        std::string d_y_data = "1";
-        std::string d_color = "black";
-        std::string d_shape = "8";
-        std::string d_size = "1";
-        std::string d_label = "";
+// the current directory, "" if it can't be found
+std::string working_dir() {
+    char buf[PATH_MAX];
+    return (getcwd(buf, sizeof(buf)) != nullptr) ? buf : "";
+}
+
+/* GnuplotPool
+* A fixed set of warm gnuplot processes, for rendering many plots without
+* paying for gnuplot's startup each time. acquire() blocks until a process is
+* free. Each plot starts with a reset, so no state leaks between plots, and a
+* process that doesn't finish a plot in time is killed and replaced.
+*/
+class GnuplotPool {
+    private:
+        std::vector<std::unique_ptr<GnuplotProcess>> idle;
+        std::mutex mutex;
+        std::condition_variable cv;
+        int timeout_ms; // most time a plot may take, < 0 for no limit
+        std::string reset; // the commands each plot starts with
     public:
-        using Layer::Layer;
-        void _update_globals() override {
-            return;
+        explicit GnuplotPool(size_t n_workers, int timeout_ms = -1)
+            : timeout_ms(timeout_ms), reset("reset session\nreset errors\n") {
+            // (a script may change directory, e.g. to its client's)
+            if (working_dir() != "") {
+                reset += "cd " + quoted(working_dir()) + "\n";
+            }
+            for (size_t i = 0; i < n_workers; i++) {
+                std::unique_ptr<GnuplotProcess> gp(new GnuplotProcess());
+                if (gp->start()) {
+                    idle.push_back(std::move(gp));
+                }
+            }
         }
-        void _update_locals() override {
-            _resolve_data_file();
-            _fill_local("x_data", d_x_data);
-            _fill_local("y_data", d_y_data);
-            _fill_local("color",  d_color);
-            _fill_local("shape",  d_shape);
-            _fill_local("size",  d_size);
-            _fill_local("label", d_label);
+        size_t size() {
+            std::lock_guard<std::mutex> lock(mutex);
+            return idle.size();
         }
-        void _set_setters() override {
-            return;
+        std::unique_ptr<GnuplotProcess> acquire() {
+            std::unique_lock<std::mutex> lock(mutex);
+            cv.wait(lock, [this] { return !idle.empty(); });
+            std::unique_ptr<GnuplotProcess> gp = std::move(idle.back());
+            idle.pop_back();
+            return gp;
+        }
+        void release(std::unique_ptr<GnuplotProcess> gp) {
+            if (!gp->running()) {
+                gp->stop();
+                gp->start(); // replace a crashed/exited worker
+            }
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                idle.push_back(std::move(gp));
+            }
+            cv.notify_one();
+        }
+        // render one plot on a worker: reset it, have write_script send the
+        // script, close any output file and wait for gnuplot to finish.
+        // False if gnuplot died or timed out, or, with error, if it reported an
+        // error in the script (which is then set to gnuplot's message).
+        bool render(const std::function<void(PipeWriter&)>& write_script, std::string* error = nullptr) {
+            std::unique_ptr<GnuplotProcess> gp = acquire();
+            // (the time limit covers sending the script too, which stalls if
+            // gnuplot stops reading it)
+            auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+            bool ok;
+            {
+                PipeWriter out(gp->input());
+                if (timeout_ms >= 0) {
+                    out.set_deadline(deadline);
+                }
+                out.write(reset);
+                write_script(out);
+                out.write("\nunset output\n");
+                ok = out.finish();
+            }
+            int left = static_cast<int>(std::max<int64_t>(0, std::chrono::duration_cast<std::chrono::milliseconds>(
+                deadline - std::chrono::steady_clock::now()).count()));
+            ok = ok && gp->sync(timeout_ms >= 0 ? left : -1, error);
+            if (!ok) {
+                gp->kill(); // (it may be stuck)
+                if (error != nullptr)
+                    error->clear();
+            }
+            release(std::move(gp));
+            return ok && (error == nullptr || error->empty());
         }
-        void _set_plotcmd() override {
-            std::string using_str = using_str_from_local(local);            
-            std::string title_str = (local["label"] == "") ? "notitle" :
-                                    " title '" + local["label"] + "'";
-            plot_command +=
-                "'" + local["file"] + "' " + using_str + " with points"
-                + " pointtype " + local["shape"]
-                + " pointsize " + local["size"]
-                + " linecolor rgb '" + local["color"] + "'"
-                + " " + title_str
-                ;
-        };
 };
 
 
-// LineLayer
-class LineLayer : public Layer {
-    protected:
-        std::string d_x_data = "1";
-        std::string d_y_data = "1";
-        std::string d_color = "black";
-        std::string d_linetype = "1";
-        std::string d_linewidth = "1";
-        std::string d_label = "";
+/* Script cache
+* The same spec (the same layers, options and data files) is often plotted over
+* and over, e.g. by a dashboard. Such a spec is keyed by a hash of its arguments
+* and the size and modification time of each file they name, and its script is
+* cached, with the output too when the plot renders to a file:
+*  - by a server, in memory: an LRU of the last --cache_entries plots
+*  - with --script_cache <dir>, on disk: <dir>/<key>.gp and <dir>/<key>.out
+* A hit skips composing the plot, and for a plot rendered to a file, gnuplot.
+* The cache is checked before the arguments are parsed, so the options it needs
+* are looked up by name (see find_option()). Specs that read stdin or a stream,
+* or that keep running (--watch, --live), aren't cached.
+*/
+
+// the value of a long option (or an abbreviation of it, as getopt allows) from
+// the unparsed arguments; false if it isn't given
+bool find_option(int argc, char* argv[], std::string_view name, std::string* value = nullptr) {
+    for (int i = 1; i < argc; i++) {
+        std::string_view arg = argv[i];
+        if (arg.substr(0, 2) != "--")
+            continue;
+        arg.remove_prefix(2);
+        size_t eq = arg.find('=');
+        std::string_view opt = arg.substr(0, eq);
+        if (opt.empty() || name.substr(0, opt.size()) != opt || (opt.size() < 3 && opt != name))
+            continue;
+        if (value != nullptr) {
+            if (eq != std::string_view::npos) {
+                *value = std::string(arg.substr(eq + 1));
+            } else if (i + 1 < argc) {
+                *value = argv[i + 1];
+            }
+        }
+        return true;
+    }
+    return false;
+}
+
+// whether an unparsed argument is a layer's file option ("-G", "--global", or an
+// abbreviation of it, as getopt allows)
+bool is_file_option(std::string_view arg) {
+    for (const auto& opt : Layers::options) {
+        if (!opt.takes_file)
+            continue;
+        std::string_view name = opt.name;
+        if (arg.size() == 2 && arg[0] == '-' && arg[1] == opt.code) {
+            return true;
+        }
+        if (arg.size() > 2 && arg.substr(0, 2) == "--") {
+            std::string_view abbrev = arg.substr(2);
+            if (name.substr(0, abbrev.size()) == abbrev && (abbrev.size() >= 3 || abbrev == name))
+                return true;
+        }
+    }
+    return false;
+}
+
+// the cache key of a spec: 0 if it can't be cached
+uint64_t spec_key(int argc, char* argv[]) {
+    for (const char* name : {"stream", "live", "watch", "server", "batch", "profile", "script"}) {
+        if (find_option(argc, argv, name)) {
+            return 0;
+        }
+    }
+    std::string output;
+    find_option(argc, argv, "output", &output);
+    // (scripts from another build may differ)
+    const char build[] = __DATE__ " " __TIME__;
+    uint64_t hash = fnv1a(14695981039346656037ull, build, sizeof(build));
+    // (relative paths name other files, and outputs, in another directory)
+    std::string cwd = working_dir();
+    hash = fnv1a(hash, cwd.data(), cwd.size() + 1);
+    for (int i = 1; i < argc; i++) {
+        std::string_view arg = argv[i];
+        hash = fnv1a(hash, arg.data(), arg.size() + 1); // with the terminator, so "a","b" != "ab"
+        // the argument may name a file, as a value or after "-G" or "--global="
+        // (and a layer's file may be a glob or list, which stands for every file
+        // it names, which may change - but other values, e.g. "($2*2)", aren't)
+        std::string_view paths[] = {arg, "", ""};
+        bool layer_file[] = {i > 1 && is_file_option(argv[i - 1]), false, false};
+        if (arg.size() > 2 && arg[0] == '-' && arg[1] != '-') {
+            paths[1] = arg.substr(2);
+            layer_file[1] = is_file_option(arg.substr(0, 2));
+        } else if (arg.substr(0, 2) == "--" && arg.find('=') != std::string_view::npos) {
+            paths[2] = arg.substr(arg.find('=') + 1);
+            layer_file[2] = is_file_option(arg.substr(0, arg.find('=')));
+        }
+        for (size_t k = 0; k < 3; k++) {
+            std::string_view path = paths[k];
+            std::vector<std::string> files = {std::string(path)};
+            if (layer_file[k] && is_multi_source(path) && !expand_source(std::string(path), files, true)) {
+                return 0; // matches nothing yet, so there's nothing to cache
+            }
+            for (const std::string& file : files) {
+                struct stat st;
+                if (file == "" || file == output || stat(file.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) {
+                    continue;
+                }
+                hash = fnv1a(hash, file.data(), file.size() + 1);
+                uint64_t stamp[3] = {static_cast<uint64_t>(st.st_size),
+                                     static_cast<uint64_t>(st.st_mtim.tv_sec),
+                                     static_cast<uint64_t>(st.st_mtim.tv_nsec)};
+                hash = fnv1a(hash, stamp, sizeof(stamp));
+            }
+        }
+    }
+    return hash == 0 ? 1 : hash;
+}
+
+bool read_file(const std::string& path, std::string& contents) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+        return false;
+    }
+    contents.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    return !in.bad();
+}
+
+// write a file in one step (through a temporary file), so readers never see
+// half of it
+bool write_file(const std::string& path, std::string_view contents) {
+    std::string tmp = path + ".tmp" + std::to_string(getpid());
+    {
+        std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+        if (!out.write(contents.data(), contents.size())) {
+            unlink(tmp.c_str());
+            return false;
+        }
+    }
+    if (rename(tmp.c_str(), path.c_str()) != 0) {
+        unlink(tmp.c_str());
+        return false;
+    }
+    return true;
+}
+
+// the file a script renders to (its "set output"), "" for a window
+std::string script_output(const std::string& script) {
+    const std::string cmd = "\nset output '";
+    size_t pos = script.rfind(cmd);
+    if (pos == std::string::npos) {
+        return "";
+    }
+    pos += cmd.size();
+    size_t end = script.find("'\n", pos);
+    return (end == std::string::npos) ? "" : script.substr(pos, end - pos);
+}
+
+// the directory a client's script starts by changing to (see client_script()),
+// "" if it doesn't
+std::string script_dir(const std::string& script) {
+    if (script.compare(0, 4, "cd '") != 0) {
+        return "";
+    }
+    std::string dir;
+    for (size_t i = 4; i < script.size() && script[i] != '\n'; i++) {
+        if (script[i] == '\'') {
+            if (i + 1 < script.size() && script[i + 1] == '\'') {
+                dir += '\'';
+                i++;
+                continue;
+            }
+            return dir;
+        }
+        dir += script[i];
+    }
+    return "";
+}
+
+// the in-memory cache of a server, shared by its connections
+class ScriptCache {
+    private:
+        struct Entry {
+            uint64_t key;
+            std::string script;
+            std::string output; // "" for a window
+            std::string image;  // the rendered output file
+        };
+        std::list<std::shared_ptr<const Entry>> entries; // most recently used first
+        std::unordered_map<uint64_t, std::list<std::shared_ptr<const Entry>>::iterator> index;
+        size_t capacity;
+        std::mutex mutex;
+        std::shared_ptr<const Entry> _get(uint64_t key) {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto it = index.find(key);
+            if (it == index.end()) {
+                return nullptr;
+            }
+            entries.splice(entries.begin(), entries, it->second);
+            return entries.front();
+        }
     public:
-        using Layer::Layer;
-        void _update_globals() override {
-            return;
+        explicit ScriptCache(size_t capacity) : capacity(capacity) {}
+        // add the script of a plot that has just been rendered
+        void put(uint64_t key, std::string script) {
+            if (capacity == 0) {
+                return;
+            }
+            std::shared_ptr<Entry> entry(new Entry{key, std::move(script), "", ""});
+            entry->output = script_output(entry->script);
+            if (entry->output != "" && entry->output[0] != '/' && script_dir(entry->script) != "") {
+                entry->output = script_dir(entry->script) + "/" + entry->output;
+            }
+            if (entry->output != "" && !read_file(entry->output, entry->image)) {
+                return;
+            }
+            std::lock_guard<std::mutex> lock(mutex);
+            auto it = index.find(key);
+            if (it != index.end()) {
+                entries.erase(it->second);
+            }
+            entries.push_front(entry);
+            index[key] = entries.begin();
+            while (entries.size() > capacity) {
+                index.erase(entries.back()->key);
+                entries.pop_back();
+            }
+        }
+        // render a cached plot: its output is written again, or a window plot's
+        // script is sent to gnuplot. False if it isn't cached (or failed).
+        bool render(uint64_t key, GnuplotPool& pool) {
+            std::shared_ptr<const Entry> entry = _get(key);
+            if (!entry) {
+                return false;
+            }
+            if (entry->output != "") {
+                return write_file(entry->output, entry->image);
+            }
+            return pool.render([&entry](PipeWriter& out) { out.write(entry->script); });
+        }
+};
+
+// where a run's plot is cached, found from its unparsed arguments
+struct CacheSpec {
+    uint64_t key = 0;    // 0 if it isn't cached
+    std::string dir;     // --script_cache, on disk
+    std::string client;  // --client, cached by the server instead
+    std::string output;  // --output, "" for a window
+    bool quiet = false;  // --quiet
+};
+
+CacheSpec find_cache_spec(int argc, char* argv[]) {
+    CacheSpec cache;
+    bool to_server = find_option(argc, argv, "client", &cache.client);
+    if (!to_server && !find_option(argc, argv, "script_cache", &cache.dir)) {
+        return cache;
+    }
+    if (to_server) {
+        cache.dir = "";
+    }
+    find_option(argc, argv, "output", &cache.output);
+    cache.quiet = find_option(argc, argv, "quiet");
+    cache.key = spec_key(argc, argv);
+    return cache;
+}
+
+// plot a spec from the on-disk cache: false (with ret untouched) if it isn't there
+bool plot_from_cache(const CacheSpec& cache, int& ret) {
+    std::string base = cache.dir + "/" + key_hex(cache.key);
+    std::string contents;
+    if (cache.output != "") {
+        if (!read_file(base + ".out", contents)) {
+            return false;
         }
-        void _update_locals() override {
-            _resolve_data_file();
-            _fill_local("x_data", d_x_data);
-            _fill_local("y_data", d_y_data);
-            _fill_local("color",  d_color);
-            _fill_local("linetype",  d_linetype);
-            _fill_local("linewidth",  d_linewidth);
-            _fill_local("label", d_label);
+        if (!cache.quiet) {
+            std::cout << "Cached: " << cache.output << std::endl;
         }
-        void _set_setters() override {
-            return;
+        ret = write_file(cache.output, contents) ? EXIT_SUCCESS : EXIT_FAILURE;
+        if (ret != EXIT_SUCCESS) {
+            std::cerr << "Error: could not write '" << cache.output << "'\n";
         }
-        void _set_plotcmd() override {
-            std::string using_str = using_str_from_local(local);            
-            std::string title_str = (local["label"] == "") ? "notitle" :
-                                    " title '" + local["label"] + "'";
-            plot_command +=
-                "'" + local["file"] + "' " + using_str + " with lines"
-                + " linetype " + local["linetype"] // TODO: check if linetype is a number or string - if string, wrap in quotes
-                + " linewidth " + local["linewidth"]
-                + " linecolor rgb '" + local["color"] + "'"
-                + " " + title_str
-                ;
-        };
-};
-    
+        return true;
+    }
+    if (!read_file(base + ".gp", contents)) {
+        return false;
+    }
+    if (!cache.quiet) {
+        std::cout << "Cached: " << base << ".gp" << std::endl;
+    }
+    FILE* gnuplotPipe = popen(cache.quiet ? "gnuplot -persist" : "gnuplot", "w");
+    if (!gnuplotPipe) {
+        std::cerr << "Error: Could not open pipe to gnuplot.\n";
+        ret = EXIT_FAILURE;
+        return true;
+    }
+    write_all(fileno(gnuplotPipe), contents.data(), contents.size());
+    if (!cache.quiet) {
+        std::cout << "Press enter to exit\n";
+        std::cin.get();
+    }
+    pclose(gnuplotPipe);
+    ret = EXIT_SUCCESS;
+    return true;
+}
 
-// Bar layer
-class BarLayer : public Layer {
-    protected:
-        std::string d_x_data = "1";
-        std::string d_y_data = "1";
-        std::string d_color = "black";
-        std::string d_shape = "1";
-        std::string gd_fillstyle = "solid";
-        std::string gd_width = "0.8";
-        std::string d_label = "";
-    public:
-        using Layer::Layer;
-        void _update_globals() override {
-            _fill_global("width", gd_width);
-            _fill_global("fillstyle", gd_fillstyle);
+// add a composed plot's script to the on-disk cache; its output is added by
+// cache_output() once it has been rendered
+void cache_script(const CacheSpec& cache, const std::string& script) {
+    mkdir(cache.dir.c_str(), 0755); // (may exist already)
+    if (!write_file(cache.dir + "/" + key_hex(cache.key) + ".gp", script)) {
+        std::cerr << "Warning: could not write to script cache '" << cache.dir << "'\n";
+    }
+}
+
+void cache_output(const CacheSpec& cache) {
+    std::string image;
+    if (cache.output != "" && read_file(cache.output, image)) {
+        write_file(cache.dir + "/" + key_hex(cache.key) + ".out", image);
+    }
+}
+
+
+/* Server mode
+* A long-lived process (--server <socket>) that keeps a GnuplotPool warm and
+* renders plot scripts sent to it over a Unix socket. A client (--client
+* <socket>) composes its layers as usual and sends the resulting script instead
+* of starting gnuplot itself.
+* The script starts with a "cd" to the client's directory, so relative paths are
+* the client's; every plot starts in the server's own directory otherwise.
+* Protocol, one plot per connection: the client sends "<n bytes>\n<script>",
+* the server replies "ok\n" or "error: <message>\n" (e.g., the error gnuplot
+* reported in the script). A cacheable plot (see the script cache below) is
+* first asked for by its key, "key <hex>\n": the server replies "ok\n" if it
+* has it, or "miss\n" and closes the connection. The client then composes the
+* plot and sends it on a new connection with its key, "<n bytes> <hex>\n...",
+* so no connection is held open (or timed out) while a plot is composed.
+*/
+bool read_all(int fd, std::string& buf, size_t n) {
+    char chunk[1 << 16];
+    while (buf.size() < n) {
+        ssize_t got = read(fd, chunk, std::min(sizeof(chunk), n - buf.size()));
+        if (got < 0 && errno == EINTR)
+            continue;
+        if (got <= 0)
+            return false;
+        buf.append(chunk, got);
+    }
+    return true;
+}
+
+// read a short "...\n" message header, without the newline
+bool read_header(int fd, std::string& header) {
+    header.clear();
+    char c;
+    while (header.size() < 64) {
+        ssize_t got = read(fd, &c, 1);
+        if (got < 0 && errno == EINTR)
+            continue;
+        if (got <= 0)
+            return false;
+        if (c == '\n')
+            return true;
+        header += c;
+    }
+    return false;
+}
+
+// the length in a "<n bytes>" header
+bool parse_length(const std::string& header, size_t& n) {
+    if (header.empty() || header.size() > 20 ||
+        header.find_first_not_of("0123456789") != std::string::npos) {
+        return false;
+    }
+    n = std::strtoull(header.c_str(), nullptr, 10);
+    return true;
+}
+
+bool socket_address(const std::string& path, sockaddr_un& addr) {
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path)) {
+        std::cerr << "Error: socket path '" << path << "' is too long\n";
+        return false;
+    }
+    std::strcpy(addr.sun_path, path.c_str());
+    return true;
+}
+
+void serve_connection(int conn, GnuplotPool& pool, ScriptCache& cache) {
+    size_t n;
+    uint64_t key = 0;
+    std::string header, script, reply;
+    bool ok = read_header(conn, header);
+    if (ok && header.compare(0, 4, "key ") == 0) {
+        key = std::strtoull(header.c_str() + 4, nullptr, 16);
+        reply = (key != 0 && cache.render(key, pool)) ? "ok\n" : "miss\n";
+        write_all(conn, reply.data(), reply.size());
+        close(conn);
+        return;
+    }
+    // (the script of a miss comes with its key)
+    if (ok && header.find(' ') != std::string::npos) {
+        key = std::strtoull(header.c_str() + header.find(' ') + 1, nullptr, 16);
+        header.resize(header.find(' '));
+    }
+    std::string error;
+    if (!ok || !parse_length(header, n) || !read_all(conn, script, n)) {
+        reply = "error: bad request\n";
+    } else if (!pool.render([&script](PipeWriter& out) { out.write(script); }, &error)) {
+        reply = error != "" ? "error: gnuplot: " + error + "\n"
+                            : "error: gnuplot exited or timed out while rendering\n";
+    } else {
+        reply = "ok\n";
+        if (key != 0) {
+            cache.put(key, std::move(script));
         }
-        void _update_locals() override {
-            _resolve_data_file();
-            _fill_local("x_data", d_x_data);
-            _fill_local("y_data", d_y_data);
-            _fill_local("color", d_color);
-            _fill_local("shape", d_shape);
+    }
+    write_all(conn, reply.data(), reply.size());
+    close(conn);
+}
+
+// at most max_connections are served at once (the others wait in the listen
+// backlog), and a connection (reading the request, and rendering it) is given
+// up after timeout_ms, so stuck clients or scripts don't hold threads forever
+int run_server(const std::string& path, size_t n_workers, size_t n_cache_entries,
+               size_t max_connections, int timeout_ms) {
+    sockaddr_un addr;
+    if (!socket_address(path, addr)) {
+        return EXIT_FAILURE;
+    }
+    signal(SIGPIPE, SIG_IGN); // a dead gnuplot or client shows up as a write error
+    GnuplotPool pool(n_workers, timeout_ms);
+    if (pool.size() == 0) {
+        std::cerr << "Error: could not start any gnuplot workers\n";
+        return EXIT_FAILURE;
+    }
+    int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(path.c_str()); // stale socket from an earlier server
+    if (sock < 0 || bind(sock, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 ||
+        listen(sock, 64) != 0) {
+        std::cerr << "Error: could not listen on '" << path << "': " << std::strerror(errno) << "\n";
+        return EXIT_FAILURE;
+    }
+    ScriptCache cache(n_cache_entries);
+    std::cout << "Serving on " << path << " with " << pool.size() << " gnuplot workers" << std::endl;
+    // (shared with the detached connection threads, which may outlive this loop)
+    struct Connections {
+        std::mutex mutex;
+        std::condition_variable cv;
+        size_t active = 0;
+    };
+    auto connections = std::make_shared<Connections>();
+    timeval conn_timeout = {timeout_ms / 1000, (timeout_ms % 1000) * 1000};
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(connections->mutex);
+            connections->cv.wait(lock, [&] { return connections->active < max_connections; });
         }
-        void _set_setters() override {
-            set_command += "set style fill " + global["fillstyle"] + "\n";
-            set_command += "set boxwidth " + global["width"] + " relative\n";
+        int conn = accept(sock, nullptr, nullptr);
+        if (conn < 0) {
+            if (errno == EINTR)
+                continue;
+            std::cerr << "Error: accept failed: " << std::strerror(errno) << "\n";
+            break;
         }
-        void _set_plotcmd() override {
-            std::string using_str = using_str_from_local(local);
-            std::string title_str = (local["label"] == "") ? "notitle" :
-                                    " title '" + local["label"] + "'";
-            plot_command +=
-                "'" + local["file"] + "' " + using_str + " with boxes"
-                + " fillstyle " + local["fill"]
-                + " linecolor rgb '" + local["color"] + "'"
-                + " " + title_str
-                ;
+        setsockopt(conn, SOL_SOCKET, SO_RCVTIMEO, &conn_timeout, sizeof(conn_timeout));
+        setsockopt(conn, SOL_SOCKET, SO_SNDTIMEO, &conn_timeout, sizeof(conn_timeout));
+        {
+            std::lock_guard<std::mutex> lock(connections->mutex);
+            connections->active++;
         }
-};
+        std::thread([conn, &pool, &cache, connections]() {
+            serve_connection(conn, pool, cache);
+            std::lock_guard<std::mutex> lock(connections->mutex);
+            connections->active--;
+            connections->cv.notify_one();
+        }).detach();
+    }
+    close(sock);
+    return EXIT_FAILURE;
+}
 
+// connect to a server, -1 (with an error) if it can't be reached
+int connect_to_server(const std::string& path) {
+    sockaddr_un addr;
+    if (!socket_address(path, addr)) {
+        return -1;
+    }
+    signal(SIGPIPE, SIG_IGN);
+    int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sock < 0 || connect(sock, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+        std::cerr << "Error: could not connect to server at '" << path << "': "
+                  << std::strerror(errno) << "\n";
+        if (sock >= 0)
+            close(sock);
+        return -1;
+    }
+    return sock;
+}
 
+// ask a server for a cached plot by its key, on a connection that is closed
+// after: true if it had it (and the plot is done). missed is set if it hasn't,
+// and left unset on an error.
+bool plot_cached_by_server(int sock, uint64_t key, bool& missed) {
+    std::string header = "key " + key_hex(key) + "\n";
+    std::string reply;
+    if (!write_all(sock, header.data(), header.size()) || !read_header(sock, reply) ||
+        (reply != "ok" && reply != "miss")) {
+        std::cerr << "Error: server: " << (reply.empty() ? "no reply" : reply) << "\n";
+    }
+    close(sock);
+    missed = (reply == "miss");
+    return reply == "ok";
+}
 
+// send a plot script on a connection to a server (with its key, if the server
+// missed it) and wait until it has been rendered
+int send_script(int sock, const std::string& script, uint64_t key = 0) {
+    std::string header = std::to_string(script.size()) + (key != 0 ? " " + key_hex(key) : "") + "\n";
+    std::string reply;
+    char chunk[256];
+    ssize_t got;
+    if (write_all(sock, header.data(), header.size()) &&
+        write_all(sock, script.data(), script.size())) {
+        while ((got = read(sock, chunk, sizeof(chunk))) > 0 || (got < 0 && errno == EINTR)) {
+            if (got > 0)
+                reply.append(chunk, got);
+        }
+    }
+    close(sock);
+    if (reply != "ok\n") {
+        std::cerr << "Error: server: " << (reply.empty() ? "no reply\n" : reply);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
 
+// send a plot script to a server and wait until it has been rendered
+// a plot's script for a server, which starts by changing to our directory, so
+// that its relative paths (data files, the output) are read as ours
+std::string client_script(Plot& plot) {
+    std::string cwd = working_dir();
+    if (cwd == "" || cwd.find('\n') != std::string::npos) {
+        std::cerr << "Warning: the server will read relative paths from its own directory\n";
+        return script_to_string(plot);
+    }
+    return "cd " + quoted(cwd) + "\n" + script_to_string(plot);
+}
 
-// dispatch function to map command line arguments to layer types
-int add_layer(std::vector<std::shared_ptr<Layer>>& layers,
-               int geom,
-               Environment& global,
-               Environment& local) {
-    std::cout << "Adding layer of type '" << geom << "'\n";
-
-    std::shared_ptr<Layer> layer_ptr;
-    switch (geom) {
-    case 'G':
-        layer_ptr.reset(new BaseLayer(global, local));
-        break;
-    case 'P':
-        layer_ptr.reset(new PointLayer(global, local));
-        break;
-    case 'L':
-        layer_ptr.reset(new LineLayer(global, local));
-        break;
-    case 'B':
-        layer_ptr.reset(new BarLayer(global, local));
-        break;
-    case 500:
-        layer_ptr.reset(new LabsLayer(global, local));
-        break;
-    case 600:
-        layer_ptr.reset(new ThemeLayer(global, local));
-        break;
-    default:
-        std::cerr << "Error: unknown layer type '" << geom << "'\n";
+int send_to_server(const std::string& path, const std::string& script, uint64_t key = 0) {
+    int sock = connect_to_server(path);
+    if (sock < 0) {
         return EXIT_FAILURE;
     }
+    return send_script(sock, script, key);
+}
 
-    layer_ptr->compose(); // compose the layer now while local env is current
-    layers.push_back(layer_ptr);
-    return EXIT_SUCCESS;
+
+// pick a gnuplot terminal for an output file from its extension
+std::string terminal_for(const std::string& output) {
+    std::string ext = output.substr(output.find_last_of('.') + 1);
+    std::transform(ext.begin(), ext.end(), ext.begin(),
+                   [](unsigned char c) { return std::tolower(c); });
+    if (ext == "png") return "pngcairo";
+    if (ext == "svg") return "svg";
+    if (ext == "pdf") return "pdfcairo";
+    if (ext == "eps") return "epscairo";
+    if (ext == "jpg" || ext == "jpeg") return "jpeg";
+    return "";
 }
 
 
@@ -510,17 +6087,34 @@ int add_layer(std::vector<std::shared_ptr<Layer>>& layers,
 * Gnuplot resources:
 *   "with": http://www.gnuplot.info/docs_4.2/node145.html
 */
-int main(int argc, char* argv[]) {
-    Environment global, local;
-    std::vector<std::shared_ptr<Layer>> layers;
+int parse_plot(int argc, char* argv[], Plot& plot, RunOptions& run) {
+    ArenaScope arena_scope(plot.arena); // composition strings go in the plot's arena
+    // (known before any layer is added, so those are quiet too; a script on
+    // stdout can't have anything else there)
+    std::string script_path;
+    run.quiet = run.quiet || find_option(argc, argv, "quiet")
+                || (find_option(argc, argv, "script", &script_path) && script_path == "-");
+    Environment& global = plot.global;
+    Environment& local = plot.local;
+    DataStore& data = plot.data;
+    LayerList& layers = plot.layers;
 
     // good reference: https://www.gnu.org/software/libc/manual/html_node/Getopt-Long-Option-Example.html
-    static struct option long_options[] = {
-        {"global",    required_argument, 0, 'G'},  // gg ggplot()
+    // (the options starting layers come from the layer registry)
+    static constexpr option plot_options[] = {
         {"sep",       required_argument, 0, 300},  // data file separator - e.g., " " or ","
-        {"point",     required_argument, 0, 'P'},  // gg geom_point()
-        {"line",      required_argument, 0, 'L'},  // gg geom_line()
-        {"bar",       required_argument, 0, 'B'},  // gg geom_bar()
+        {"binary",    no_argument,       0, 301},  // send inline data as packed float64 instead of text
+        {"stream",    required_argument, 0, 302},  // read inline data from a file/FIFO, or "-" for stdin
+        {"load",      no_argument,       0, 303},  // parse the data file in-process instead of in gnuplot
+        {"threads",   required_argument, 0, 304},  // worker threads for loading data (default: one per core)
+        {"downsample",required_argument, 0, 305},  // reduce line/point data to about n points in-process
+        {"downsample_method", required_argument, 0, 306},  // "lttb" (default) or "minmax"
+        {"bins",      required_argument, 0, 307},  // number of histogram bins (default: 30)
+        {"binwidth",  required_argument, 0, 308},  // width of histogram bins, overrides --bins
+        {"palette",   required_argument, 0, 309},  // gn set palette, for bin2d (e.g., "rgbformulae 7,5,15")
+        {"method",    required_argument, 0, 310},  // smoothing method: "loess", "lm" or "bin"
+        {"span",      required_argument, 0, 311},  // loess span (default: 0.75)
+        {"se",        required_argument, 0, 312},  // draw the confidence band of a smooth (default: 1)
         {"color",     required_argument, 0, 'c'},  // gn linecolor
         {"fill",      required_argument, 0, 'c'},  // gn color, ggplot fill is same as color in gnuplot
         {"shape",     required_argument, 0, 's'},  // gn pointtype
@@ -535,164 +6129,635 @@ int main(int argc, char* argv[]) {
         {"theme",     no_argument,       0, 600},  // gg theme()
         {"legend_position", required_argument, 0, 601},  // gg theme(legend.position)
         {"legend_direction",required_argument, 0, 602},  // gg theme(legend.direction)
-        {0, 0, 0, 0}
+        {"server",    required_argument, 0, 700},  // run as a plot server on a unix socket
+        {"workers",   required_argument, 0, 701},  // number of warm gnuplot processes for --server
+        {"client",    required_argument, 0, 702},  // send the plot to a server instead of running gnuplot
+        {"batch",     required_argument, 0, 703},  // render every plot spec in a manifest file
+        {"jobs",      required_argument, 0, 704},  // number of gnuplot processes for --batch
+        {"live",      required_argument, 0, 313},  // plot the last n samples of a --stream, redrawn as they arrive
+        {"ncol",      required_argument, 0, 314},  // panels per row of a --facet wrap (default: about square)
+        {"cache",     required_argument, 0, 315},  // keep loaded files in a directory as columnar binary, not parsed again
+        {"xlim",      required_argument, 0, 316},  // x axis limits "lo:hi"; loaded files keep only the rows in range
+        {"merge",     no_argument,       0, 317},  // merge the files of a glob/list source by x (each sorted by x)
+        {"fps",       required_argument, 0, 707},  // most frames per second for --live (default: 10)
+        {"watch",     no_argument,       0, 705},  // keep the plot open and follow appends to its data files
+        {"watch_interval", required_argument, 0, 706},  // least ms between --watch updates (default: 500)
+        {"script_cache",  required_argument, 0, 708},  // cache scripts (and outputs) of repeated plots in a dir
+        {"cache_entries", required_argument, 0, 709},  // number of plots a --server caches (default: 64)
+        {"profile",   required_argument, 0, 710},  // time each stage, reported on stderr as "text" or "json"
+        {"quiet",     no_argument,       0, 711},  // print nothing on stdout, and don't wait on stdin
+        {"script",    required_argument, 0, 712},  // write the script to a file, "fd:N" or "-" (stdout), no gnuplot
+        {"render_timeout",  required_argument, 0, 713},  // ms a --server connection may take before it's dropped (default: 60000)
+        {"max_connections", required_argument, 0, 714},  // connections a --server serves at once (default: 64)
+        {"output",    required_argument, 0, 800},  // gn set output - render to a file
+        {"terminal",  required_argument, 0, 801},  // gn set terminal (default: from the --output extension)
     };
-    const char* short_options = "G:P:L:B:x:y:c:s:m:t:w:f:l:";
+    static constexpr auto long_options = make_long_options(plot_options);
+    static constexpr auto short_options = make_short_options("x:y:c:s:m:t:w:f:l:");
 
     int layer_count = 0;
     int opt_ix = 0;
     int opt;
     int ret;
-    int current_geom;
-    while ((opt = getopt_long(argc, argv, short_options, long_options, &opt_ix)) != -1) {
+    int current_geom = 0;
+    bool ok = true; // false once an option has an invalid value
+    optind = 0; // (re)start getopt, plots may be parsed more than once per run
+    while ((opt = getopt_long(argc, argv, short_options.data(), long_options.data(), &opt_ix)) != -1) {
+        const LayerOption* layer_opt = Layers::find(opt);
+        if (layer_opt != nullptr) {
+            if (opt == BaseLayer::option.code && layer_count > 0) {
+                std::cerr << "Error: if global layer (--global,-G) is used, it should be set first\n";
+                return EXIT_FAILURE;
+            }
+            if (layer_count > 0) {
+                // finish up previous layer
+                ret = add_layer(layers, current_geom, global, plot.keep_local(), data, run.quiet);
+                if (ret != EXIT_SUCCESS)
+                    return ret;
+                // reset local env for each new layer
+                local.clear();
+            }
+            if (layer_opt->takes_file && !local.insert(Key::file, optarg)) {
+                return EXIT_FAILURE;
+            }
+            current_geom = opt;
+            layer_count++;
+            continue;
+        }
         switch (opt) {
-            case 'G':
-            case 'P':
-            case 'L':
-            case 'B':
-            case 500: // labs
-            case 600: // theme
-                if (opt == 'G' && layer_count > 0) {
-                    std::cerr << "Error: if global layer (--global,-G) is used, it should be set first\n";
-                    return EXIT_FAILURE;
-                }
-                if (layer_count > 0) {
-                    // finish up previous layer
-                    ret = add_layer(layers, current_geom, global, local);
-                    if (ret != EXIT_SUCCESS)
-                        return ret;
-                    // reset local env for each new layer
-                    local = Environment();
-                }
-                if (opt < 500) {
-                    // required arg for geom layers only
-                    local.insert("file", optarg);
-                }
-                current_geom = opt;
-                layer_count++;
-                break;
             case 'x':
-                if (current_geom == 500) {
-                    local.insert("xlab", optarg);
+                if (current_geom == LabsLayer::option.code) {
+                    ok = local.insert(Key::xlab, optarg);
+                } else if (current_geom == FacetLayer::option.code) {
+                    ok = local.insert(Key::facet_x, optarg);
                 } else {
-                    local.insert("x_data", optarg);
+                    ok = local.insert(Key::x_data, optarg);
                 }
                 break;
             case 'y':
-                if (current_geom == 500) {
-                    local.insert("ylab", optarg);
+                if (current_geom == LabsLayer::option.code) {
+                    ok = local.insert(Key::ylab, optarg);
+                } else if (current_geom == FacetLayer::option.code) {
+                    ok = local.insert(Key::facet_y, optarg);
                 } else {
-                    local.insert("y_data", optarg);
+                    ok = local.insert(Key::y_data, optarg);
                 }
                 break;
             case 'c':
-                local.insert("color", optarg);
+                ok = local.insert(Key::color, optarg);
                 break;
             case 's':
-                local.insert("shape", optarg);
+                ok = local.insert(Key::shape, optarg);
                 break;
             case 'm':
-                local.insert("size", optarg);
+                ok = local.insert(Key::size, optarg);
                 break;
             case 't':
-                local.insert("linetype", optarg);
+                ok = local.insert(Key::linetype, optarg);
                 break;
             case 'w':
-                if (current_geom == 'L') {
-                    local.insert("linewidth", optarg);
-                } else if (current_geom == 'B') {
-                    local.insert("width", optarg);
+                if (current_geom == LineLayer::option.code || current_geom == SmoothLayer::option.code) {
+                    ok = local.insert(Key::linewidth, optarg);
+                } else if (current_geom == BarLayer::option.code || current_geom == HistogramLayer::option.code) {
+                    ok = local.insert(Key::width, optarg);
                 }
                 break;
             case 'f':
-                local.insert("fillstyle", optarg);
+                ok = local.insert(Key::fillstyle, optarg);
                 break;
             case 'l':
-                local.insert("label", optarg);
+                ok = local.insert(Key::label, optarg);
                 break;
             case 300:
-                local.insert("file_delim", optarg);
+                ok = local.insert(Key::file_delim, optarg);
+                break;
+            case 301:
+                ok = local.insert(Key::binary, "1");
+                break;
+            case 302:
+                ok = local.insert(Key::stream, optarg);
+                break;
+            case 303:
+                ok = local.insert(Key::load, "1");
+                break;
+            case 304:
+                ok = local.insert(Key::threads, optarg);
+                break;
+            case 305:
+                ok = local.insert(Key::downsample, optarg);
+                break;
+            case 306:
+                ok = local.insert(Key::downsample_method, optarg);
+                break;
+            case 307:
+                ok = local.insert(Key::bins, optarg);
+                break;
+            case 308:
+                ok = local.insert(Key::binwidth, optarg);
+                break;
+            case 309:
+                ok = local.insert(Key::palette, optarg);
+                break;
+            case 310:
+                ok = local.insert(Key::method, optarg);
+                break;
+            case 311:
+                ok = local.insert(Key::span, optarg);
+                break;
+            case 312:
+                ok = local.insert(Key::se, optarg);
                 break;
             case 501:
-                local.insert("title", optarg);
+                ok = local.insert(Key::title, optarg);
                 break;
             case 601:
-                local.insert("legend_position", optarg);
+                ok = local.insert(Key::legend_position, optarg);
                 break;
             case 602:
-                local.insert("legend_direction", optarg);
+                ok = local.insert(Key::legend_direction, optarg);
+                break;
+            case 700:
+                run.server_path = optarg;
+                break;
+            case 701:
+                run.n_workers = std::max(1ul, std::strtoul(optarg, nullptr, 10));
+                break;
+            case 702:
+                run.client_path = optarg;
+                break;
+            case 703:
+                run.batch_path = optarg;
+                break;
+            case 704:
+                run.n_jobs = std::strtoul(optarg, nullptr, 10);
+                break;
+            case 705:
+                run.watch = true;
+                break;
+            case 707:
+                run.fps = std::strtod(optarg, nullptr);
+                break;
+            case 313:
+                ok = local.insert(Key::live, optarg);
+                break;
+            case 314:
+                ok = local.insert(Key::ncol, optarg);
+                break;
+            case 315:
+                ok = local.insert(Key::cache, optarg);
+                break;
+            case 316:
+                ok = local.insert(Key::xlim, optarg);
+                break;
+            case 317:
+                ok = local.insert(Key::merge, "1");
+                break;
+            case 706:
+                run.watch_interval = std::atoi(optarg);
+                break;
+            case 708:
+                run.script_cache = optarg;
+                break;
+            case 709:
+                run.n_cache_entries = std::strtoul(optarg, nullptr, 10);
+                break;
+            case 711:
+                break; // (found before parsing, see above)
+            case 712:
+                run.script_path = optarg;
+                break;
+            case 713:
+                run.render_timeout_ms = std::max(1, std::atoi(optarg));
+                break;
+            case 714:
+                run.max_connections = std::max(1ul, std::strtoul(optarg, nullptr, 10));
+                break;
+            case 710:
+                // (enabled before parsing, see main())
+                if (std::string(optarg) != "text" && std::string(optarg) != "json") {
+                    std::cerr << "Error: --profile must be text or json\n";
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 800:
+                plot.output = optarg;
+                break;
+            case 801:
+                plot.terminal = optarg;
                 break;
             default:
                 std::cerr << "Error: unknown option\n";
                 return EXIT_FAILURE;
         }
+        if (!ok) {
+            return EXIT_FAILURE;
+        }
+    }
+    if (run.server_path != "" || run.batch_path != "") {
+        return EXIT_SUCCESS; // no layers of its own
+    }
+    if (layer_count == 0) {
+        std::cerr << "Error: no layers to plot\n";
+        return EXIT_FAILURE;
     }
     // last layer
-    ret = add_layer(layers, current_geom, global, local);
+    ret = add_layer(layers, current_geom, global, plot.keep_local(), data, run.quiet);
     if (ret != EXIT_SUCCESS)
         return ret;
-    std::cout << "Layers: " << layer_count << std::endl;
+    if (!run.quiet) {
+        std::cout << "Layers: " << layer_count << std::endl;
+    }
+    if (!prepare_layers(plot)) {
+        return EXIT_FAILURE;
+    }
+
+    // split the data into panels, if faceted
+    bool faceted;
+    {
+        StageTimer timer("facet");
+        faceted = facet_plot(plot);
+    }
+    if (!faceted) {
+        return EXIT_FAILURE;
+    }
+    if (plot.facets.enabled() && run.watch) {
+        std::cerr << "Error: --watch can't follow a --facet plot\n";
+        return EXIT_FAILURE;
+    }
+    for (const auto& ds : data.get_datasets()) {
+        if (run.watch && ds->referenced && is_multi_source(ds->path)) {
+            std::cerr << "Error: --watch can't follow a multi-file source\n";
+            return EXIT_FAILURE;
+        }
+    }
+    // send files that several layers read only once
+    plot.shared_files = share_data_files(layers);
 
-    layer_count = 0;
-    std::string set_lines = "", plot_lines = "plot ", data_lines = "", line = "";
-    for (const auto& layer : layers) {
-        line = layer->get_set_line();
+    if (plot.output != "") {
+        if (plot.terminal == "") {
+            plot.terminal = terminal_for(plot.output);
+        }
+        if (plot.terminal == "") {
+            std::cerr << "Error: no terminal for output '" << plot.output << "', use --terminal\n";
+            return EXIT_FAILURE;
+        }
+        plot.set_lines += "set terminal " + plot.terminal + "\n";
+        plot.set_lines += "set output '" + plot.output + "'\n";
+    }
+    Text line = "";
+    for (Layer& layer : layers) {
+        line = layer.get_set_line();
         if (line != "") {
-            set_lines += line;
+            plot.set_lines += line;
         }
-        line = layer->get_plot_line();
+        line = layer.get_plot_line();
         if (line != "") {
-            plot_lines += line + ",";
-        } 
-        data_lines += layer->get_inline_data();
-        layer_count++;
+            plot.plot_lines += line + ",";
+        }
+        plot.stdin_used = plot.stdin_used || layer.reads_stdin();
     }
-    // print items in global env
-    std::cout << "__Global settings__\n";
-    for (const auto& item : global._params()) {
-        std::cout << item.first << ": " << item.second << std::endl;
+    return EXIT_SUCCESS;
+}
+
+
+/* Batch mode
+* Render every plot spec in a manifest file (--batch), headless: one spec per
+* line, written as the arguments would be on the command line, each with its
+* own --output. All specs are composed first, then rendered on --jobs warm
+* gnuplot processes, reporting each job's latency and the overall throughput.
+* Blank lines and lines starting with '#' are skipped.
+*/
+
+// split a manifest line into arguments, as a shell would: whitespace separates
+// arguments, quotes group them ('' is an empty argument), backslash escapes
+std::vector<std::string> split_args(const std::string& line) {
+    std::vector<std::string> args;
+    std::string arg;
+    bool in_arg = false;
+    char quote = 0;
+    for (size_t i = 0; i < line.size(); i++) {
+        char c = line[i];
+        if (quote == '\'') {
+            if (c == '\'') quote = 0; else arg += c;
+        } else if (quote == '"') {
+            if (c == '"') {
+                quote = 0;
+            } else if (c == '\\' && i + 1 < line.size() &&
+                       std::strchr("\"\\$`", line[i + 1]) != nullptr) {
+                arg += line[++i];
+            } else {
+                arg += c;
+            }
+        } else if (c == '\'' || c == '"') {
+            quote = c;
+            in_arg = true;
+        } else if (c == '\\' && i + 1 < line.size()) {
+            arg += line[++i];
+            in_arg = true;
+        } else if (std::isspace(static_cast<unsigned char>(c))) {
+            if (in_arg) {
+                args.push_back(arg);
+                arg.clear();
+                in_arg = false;
+            }
+        } else {
+            arg += c;
+            in_arg = true;
+        }
+    }
+    if (in_arg) {
+        args.push_back(arg);
     }
+    return args;
+}
 
-    // open pipe to gnuplot and write commands
-    // note: adding --persist flag will allow user to keep the plot window open
-    //       even after this program ends, but keeping the program running seems
-    //       to allow for more functionality on the gnuplot side
-    FILE* gnuplotPipe = popen("gnuplot", "w");
-    if (!gnuplotPipe) {
-        std::cerr << "Error: Could not open pipe to gnuplot.\n";
+struct BatchJob {
+    size_t line_number;
+    std::unique_ptr<Plot> plot; // null if the spec couldn't be composed
+    double seconds = 0;
+    bool ok = false;
+};
+
+int run_batch(const RunOptions& run) {
+    std::ifstream manifest(run.batch_path);
+    if (!manifest) {
+        std::cerr << "Error: could not open batch manifest '" << run.batch_path << "'\n";
+        return EXIT_FAILURE;
+    }
+    auto start = std::chrono::steady_clock::now();
+
+    // compose every spec (serially - getopt isn't reentrant)
+    std::vector<BatchJob> jobs;
+    std::string line;
+    size_t line_number = 0;
+    while (std::getline(manifest, line)) {
+        line_number++;
+        std::vector<std::string> args = split_args(line);
+        if (args.empty() || args[0][0] == '#') {
+            continue;
+        }
+        args.insert(args.begin(), "main");
+        std::vector<char*> argv;
+        for (auto& arg : args) {
+            argv.push_back(&arg[0]);
+        }
+        argv.push_back(nullptr);
+
+        BatchJob job;
+        job.line_number = line_number;
+        std::unique_ptr<Plot> plot(new Plot());
+        RunOptions job_run;
+        job_run.quiet = run.quiet;
+        if (parse_plot(argv.size() - 1, argv.data(), *plot, job_run) != EXIT_SUCCESS) {
+            std::cerr << "Error: could not compose batch line " << line_number << "\n";
+        } else if (plot->output == "") {
+            std::cerr << "Error: batch line " << line_number << " has no --output\n";
+        } else {
+            job.plot = std::move(plot);
+        }
+        jobs.push_back(std::move(job));
+    }
+    double compose_seconds = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - start).count();
+
+    // render them, each worker thread taking the next job and a free gnuplot
+    size_t n_jobs = run.n_jobs > 0 ? run.n_jobs : std::max(1u, std::thread::hardware_concurrency());
+    signal(SIGPIPE, SIG_IGN);
+    GnuplotPool pool(n_jobs);
+    if (pool.size() == 0) {
+        std::cerr << "Error: could not start any gnuplot workers\n";
         return EXIT_FAILURE;
     }
+    std::atomic<size_t> next{0};
+    auto render_jobs = [&]() {
+        size_t i;
+        while ((i = next++) < jobs.size()) {
+            BatchJob& job = jobs[i];
+            if (!job.plot)
+                continue;
+            auto job_start = std::chrono::steady_clock::now();
+            job.ok = pool.render([&job](PipeWriter& out) { write_script(out, *job.plot); });
+            job.seconds = std::chrono::duration<double>(
+                std::chrono::steady_clock::now() - job_start).count();
+        }
+    };
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < n_jobs; i++) {
+        threads.emplace_back(render_jobs);
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    double total_seconds = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - start).count();
 
-    putchar('\n');
-    // write set commands
-    std::cout << set_lines << std::endl;
-    fprintf(gnuplotPipe, "%s\n", set_lines.c_str());
-    // write plot command
-    std::cout << plot_lines << std::endl;
-    fprintf(gnuplotPipe, "%s\n", plot_lines.c_str());
-    // write data
-    if (!data_lines.empty()) {
-        fprintf(gnuplotPipe, "%s", data_lines.c_str());
+    size_t n_ok = 0, n_arena_allocs = 0, n_arena_blocks = 0;
+    for (const auto& job : jobs) {
+        n_ok += job.ok;
+        size_t n_allocs = job.plot ? job.plot->arena.n_allocs() : 0;
+        n_arena_allocs += n_allocs;
+        n_arena_blocks += job.plot ? job.plot->arena.n_blocks() : 0;
+        printf("line %zu: %s %8.2f ms %6zu allocs  %s\n", job.line_number, job.ok ? "ok   " : "error",
+               job.seconds * 1e3, n_allocs, job.plot ? job.plot->output.c_str() : "-");
     }
+    printf("%zu/%zu plots in %.3f s (composing %.3f s), %.1f plots/s with %zu gnuplot workers\n",
+           n_ok, jobs.size(), total_seconds, compose_seconds,
+           n_ok / total_seconds, pool.size());
+    printf("%zu arena allocations from %zu heap blocks\n", n_arena_allocs, n_arena_blocks);
+    return n_ok == jobs.size() ? EXIT_SUCCESS : EXIT_FAILURE;
+}
 
-    fflush(gnuplotPipe);
 
-    // send any user input to gnuplot
-    std::cout << "Press enter to exit\n";
-    std::cin.get();
-    
+#ifndef GG_PLOT_NO_MAIN
+int main(int argc, char* argv[]) {
+    // (first, so that parsing the arguments is timed too)
+    std::string profile_format;
+    if (find_option(argc, argv, "profile", &profile_format)) {
+        profiler().enable(profile_format == "json");
+    }
+    ProfileReport profile_report;
 
-    // close pipe
-    pclose(gnuplotPipe);
+    // a spec that was plotted before may not need composing (or rendering) again
+    CacheSpec cache = find_cache_spec(argc, argv);
+    uint64_t server_key = 0; // the key of a plot the server doesn't have yet
+    int ret;
+    if (cache.key != 0 && cache.client != "") {
+        int sock = connect_to_server(cache.client);
+        bool missed = false;
+        if (sock >= 0 && plot_cached_by_server(sock, cache.key, missed)) {
+            if (!cache.quiet) {
+                std::cout << "Cached by server" << std::endl;
+            }
+            return EXIT_SUCCESS;
+        }
+        if (!missed) {
+            return EXIT_FAILURE;
+        }
+        server_key = cache.key;
+    } else if (cache.key != 0 && plot_from_cache(cache, ret)) {
+        return ret;
+    }
 
-    return 0;
-}
+    Plot plot;
+    RunOptions run;
+    {
+        StageTimer timer("parse arguments");
+        ret = parse_plot(argc, argv, plot, run);
+    }
+    if (ret != EXIT_SUCCESS)
+        return ret;
+    if (run.server_path != "") {
+        return run_server(run.server_path, run.n_workers, run.n_cache_entries, run.max_connections,
+                          run.render_timeout_ms);
+    }
+    if (run.batch_path != "") {
+        return run_batch(run);
+    }
 
+    if (run.watch) {
+        if (plot.output != "") {
+            std::cerr << "Error: --watch follows a plot in a window, it can't be used with --output\n";
+            return EXIT_FAILURE;
+        }
+        for (Layer& layer : plot.layers) {
+            if (layer.reads_stream() || layer.get_live() != nullptr) {
+                std::cerr << "Error: --watch can't follow --stream or --live data, which is only read once\n";
+                return EXIT_FAILURE;
+            }
+        }
+    }
 
+    // print items in global env
+    if (!run.quiet) {
+        std::cout << "__Global settings__\n";
+        plot.global.for_each([](Key key, std::string_view value) {
+            std::cout << key_name(key) << ": " << value << std::endl;
+        });
+        std::cout << "Arena: " << plot.arena.n_allocs() << " allocations, " << plot.arena.n_bytes()
+                  << " bytes in " << plot.arena.n_blocks() << " heap blocks" << std::endl;
+    }
 
+    // hand the script to a plot server, if there is one
+    if (run.client_path != "") {
+        std::string script = client_script(plot);
+        return send_to_server(run.client_path, script, server_key);
+    }
 
+    // or write it out for someone else to render (e.g., a remote gnuplot)
+    if (run.script_path != "") {
+        bool live = false;
+        for (Layer& layer : plot.layers) {
+            live = live || layer.get_live() != nullptr;
+        }
+        if (live || run.watch) {
+            std::cerr << "Error: --live and --watch plots can't be written with --script\n";
+            return EXIT_FAILURE;
+        }
+        StageTimer timer("write script");
+        return write_script_to(run.script_path, plot) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
 
+    // open pipe to gnuplot and write commands
+    // note: adding --persist flag will allow user to keep the plot window open
+    //       even after this program ends, but keeping the program running seems
+    //       to allow for more functionality on the gnuplot side
+    // (when profiling, gnuplot is run as a child whose output is read back, so
+    // that its render can be timed by a sentinel round trip)
+    GnuplotProcess profiled;
+    FILE* gnuplotPipe = nullptr;
+    if (profiler().enabled()) {
+        if (!profiled.start()) {
+            std::cerr << "Error: Could not start gnuplot.\n";
+            return EXIT_FAILURE;
+        }
+    } else {
+        // (a quiet plot doesn't wait for the user, so its window has to outlive us)
+        gnuplotPipe = popen((run.quiet && plot.output == "") ? "gnuplot -persist" : "gnuplot", "w");
+        if (!gnuplotPipe) {
+            std::cerr << "Error: Could not open pipe to gnuplot.\n";
+            return EXIT_FAILURE;
+        }
+    }
+    int gnuplot_fd = (gnuplotPipe != nullptr) ? fileno(gnuplotPipe) : profiled.input();
 
+    if (!run.quiet) {
+        putchar('\n');
+        std::cout << plot.set_lines << std::endl;
+        if (plot.facets.enabled()) {
+            for (const Text& line : plot.facets.plot_lines) {
+                std::cout << line << "\n";
+            }
+            std::cout << std::flush;
+        } else {
+            std::cout << plot.plot_lines << std::endl;
+        }
+    }
+    bool live = false;
+    for (Layer& layer : plot.layers) {
+        live = live || layer.get_live() != nullptr;
+    }
+    if (live) {
+        ret = run_live(plot, gnuplot_fd, run.fps);
+        if (ret != EXIT_SUCCESS) {
+            if (gnuplotPipe != nullptr)
+                pclose(gnuplotPipe);
+            return ret;
+        }
+    } else if (cache.key != 0) {
+        std::string script = script_to_string(plot);
+        cache_script(cache, script);
+        write_all(gnuplot_fd, script.data(), script.size());
+    } else {
+        StageTimer timer("write script");
+        PipeWriter out(gnuplot_fd);
+        write_script(out, plot);
+        out.finish();
+        timer.bytes = out.bytes_written();
+    }
+    bool rendered = true;
+    if (profiler().enabled()) {
+        StageTimer timer("render");
+        if (plot.output != "") {
+            write_all(gnuplot_fd, "unset output\n", 13); // (the file is finished, too)
+        }
+        rendered = profiled.sync();
+    }
 
+    // send any user input to gnuplot
+    // (if the data was streamed from stdin, it's used up - wait on the terminal)
+    // rendering to a file (or a quiet plot) doesn't need to wait
+    if (plot.output == "" && run.watch) {
+        // (stdin may be at its end - redirected, used up, or closed by nohup -
+        // which poll() takes as input, so enter is read from the terminal)
+        int input_fd = (plot.stdin_used || !isatty(STDIN_FILENO)) ? open("/dev/tty", O_RDONLY) : STDIN_FILENO;
+        if (!run.quiet) {
+            std::cout << (input_fd >= 0 ? "Press enter to exit\n" : "Watching until interrupted\n");
+        }
+        watch_plot(plot, gnuplot_fd, input_fd, run.watch_interval);
+        if (input_fd >= 0 && input_fd != STDIN_FILENO) {
+            close(input_fd);
+        }
+    } else if (plot.output == "" && !run.quiet) {
+        std::cout << "Press enter to exit\n";
+        if (plot.stdin_used) {
+            std::ifstream tty("/dev/tty");
+            tty.get();
+        } else {
+            std::cin.get();
+        }
+    }
 
+    // close pipe
+    int status = rendered ? 0 : EXIT_FAILURE;
+    if (gnuplotPipe != nullptr) {
+        status = pclose(gnuplotPipe);
+    } else {
+        profiled.stop();
+    }
+    if (cache.key != 0 && status == 0) {
+        cache_output(cache); // once gnuplot has finished writing it
+    }
 
+    return 0;
+}
+#endif // GG_PLOT_NO_MAIN